@@ -33,9 +33,31 @@
 #ifndef SINGULARITY_CPP11_HPP_
 #define SINGULARITY_CPP11_HPP_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <boost/assert.hpp>
+#include <boost/mpl/has_xxx.hpp>
+#include <boost/throw_exception.hpp>
 
+// Define BOOST_SINGULARITY_LIGHTWEIGHT to include only the single_threaded
+// policy, so that translation units which need no other policy do without
+// the threading library.  The others are then in "singularity_cpp11_policies.hpp".
+#include <singularity_cpp11_single_threaded.hpp>
+#ifndef BOOST_SINGULARITY_LIGHTWEIGHT
 #include <singularity_cpp11_policies.hpp>
+#endif
+#include <singularity_cpp11_storage.hpp>
 
 namespace boost {
 
@@ -71,49 +93,630 @@ struct singularity_no_global_access : virtual std::exception
     }
 };
 
+// Specialize singularity_leak_at_exit for a type T, or define
+// BOOST_SINGULARITY_LEAK_AT_EXIT for every type, to leave an instance
+// which was never destroyed to the operating system when the program
+// exits.  No destructor is then registered for it, while an explicit
+// destroy() still runs the destructor of T as usual.
+#ifdef BOOST_SINGULARITY_LEAK_AT_EXIT
+template <class T> struct singularity_leak_at_exit : std::integral_constant<bool, true> {};
+#else
+template <class T> struct singularity_leak_at_exit : std::integral_constant<bool, false> {};
+#endif
+
+// Specialize singularity_compact_state for a type T, or define
+// BOOST_SINGULARITY_COMPACT_STATE for every type, to keep the instance
+// pointer, the global access flag, and the lock of compact_multi_threaded
+// together in a single word.  The instance must then be aligned to at
+// least four bytes, which the storage policies of singularity ensure.
+#ifdef BOOST_SINGULARITY_COMPACT_STATE
+template <class T> struct singularity_compact_state : std::integral_constant<bool, true> {};
+#else
+template <class T> struct singularity_compact_state : std::integral_constant<bool, false> {};
+#endif
+
 namespace detail {
 
-// This pointer only depends on type T, so regardless of the threading
-// model, only one singularity of type T can be created.
+template <class T> struct singularity_reaper;
+template <class T> struct singularity_declaration;
+
+// The instance pointer, and the flag which grants it global access.  The
+// flag is stored before the pointer is published, so a reader which
+// acquires the pointer also observes the flag.  The flag is left as is
+// when the pointer is cleared, so get_global() can still tell why it
+// failed.
+template <class T, bool = singularity_compact_state<T>::value> class singularity_pointer
+{
+public:
+    constexpr singularity_pointer() : instance(0), global(false) {}
+
+    inline T* load(std::memory_order order) const
+    {
+        return instance.load(order);
+    }
+    inline void store(T * pointer, std::memory_order order)
+    {
+        instance.store(pointer, order);
+    }
+    inline bool global_enabled() const
+    {
+        return global.load(std::memory_order_relaxed);
+    }
+    // Acquires the instance, or returns 0 if it has no global access.
+    inline T* load_global() const
+    {
+        T * pointer = instance.load(std::memory_order_acquire);
+        if (global.load(std::memory_order_relaxed) == false)
+        {
+            return 0;
+        }
+        return pointer;
+    }
+    inline void enable_global()
+    {
+        global.store(true, std::memory_order_relaxed);
+    }
+    inline void publish(T * pointer, bool enabled)
+    {
+        global.store(enabled, std::memory_order_relaxed);
+        instance.store(pointer, std::memory_order_release);
+    }
+private:
+    std::atomic<T *> instance;
+    std::atomic<bool> global;
+};
+
+// Packs the flag and a lock bit into the low bits of the pointer, so
+// get_global() reads one word and tests one bit.  Only the holder of
+// the lock bit writes the word, and it keeps the bit set while it does.
+template <class T> class singularity_pointer<T, true>
+{
+public:
+    constexpr singularity_pointer() : word(0) {}
+
+    inline T* load(std::memory_order order) const
+    {
+        return reinterpret_cast<T *>(word.load(order) & ~tag_bits);
+    }
+    inline void store(T * pointer, std::memory_order order)
+    {
+        word.store(tag(pointer) | (word.load(std::memory_order_relaxed) & tag_bits), order);
+    }
+    inline bool global_enabled() const
+    {
+        return (word.load(std::memory_order_relaxed) & global_bit) != 0;
+    }
+    inline T* load_global() const
+    {
+        std::uintptr_t const value = word.load(std::memory_order_acquire);
+        return (value & global_bit) != 0 ? reinterpret_cast<T *>(value & ~tag_bits) : 0;
+    }
+    inline void enable_global()
+    {
+        word.fetch_or(global_bit, std::memory_order_relaxed);
+    }
+    inline void publish(T * pointer, bool enabled)
+    {
+        word.store(tag(pointer) | (enabled ? global_bit : 0) | (word.load(std::memory_order_relaxed) & lock_bit),
+                   std::memory_order_release);
+    }
+
+    // The lock of compact_multi_threaded, which is only tried while it
+    // looks free, so that waiters never write the word of the holder.
+    inline bool try_lock()
+    {
+        std::uintptr_t value = word.load(std::memory_order_relaxed);
+        return (value & lock_bit) == 0
+            && word.compare_exchange_weak(value, value | lock_bit, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+    inline void unlock()
+    {
+        word.fetch_and(~lock_bit, std::memory_order_release);
+    }
+private:
+    static std::uintptr_t const global_bit = 1;
+    static std::uintptr_t const lock_bit = 2;
+    static std::uintptr_t const tag_bits = global_bit | lock_bit;
+
+    static inline std::uintptr_t tag(T * pointer)
+    {
+        BOOST_ASSERT((reinterpret_cast<std::uintptr_t>(pointer) & tag_bits) == 0);
+        return reinterpret_cast<std::uintptr_t>(pointer);
+    }
+
+    std::atomic<std::uintptr_t> word;
+};
+
+// The state of a singularity only depends on type T, so regardless of
+// the threading model, only one singularity of type T can be created.
+// The pointer is published with release semantics, so policies which do
+// not lock in get_global() can read it with a single acquire load.  The
+// destroyer is recorded on creation, so the instance is always returned
+// to the storage policy which supplied it, together with the deallocator,
+// which only returns the memory once recreate() ran the destructor.
+// The pointer read by get_global() is kept first, and the state is given
+// a cache line of its own when BOOST_SINGULARITY_CACHE_LINE_SIZE is
+// defined.  The generation is advanced whenever an instance is published,
+// replaced or destroyed, which invalidates the thread local caches of
+// get_global_cached().  The
+// declaration holds the arguments of declare_global() until the first
+// get_global() builds the instance, and is only read when ptr is 0.
+// The number of threads blocked in get_global_wait() and
+// get_global_wait_for(), and of coroutines suspended in when_created(),
+// lets publish() skip waking them when there are none.
+template <class T> struct BOOST_SINGULARITY_CACHE_ALIGNED singularity_state
+{
+    constexpr singularity_state() : ptr(), generation(1), declared(0), waiting(0), destroyer(0), deallocator(0) {}
+
+    singularity_pointer<T> ptr;
+    std::atomic<unsigned long> generation;
+    std::atomic<singularity_declaration<T> *> declared;
+    std::atomic<unsigned> waiting;
+    void (*destroyer)(T *);
+    void (*deallocator)(T *);
+};
+
 template <class T> struct singularity_instance
 {
-    static bool get_enabled;
-    static std::unique_ptr<T> ptr;
+    static singularity_state<T> state;
+    static singularity_reaper<T> reaper;
+};
+
+// Destroys an instance which was never destroyed when the program exits,
+// or the arguments of a declaration which was never built.
+template <class T> struct singularity_reaper
+{
+    inline ~singularity_reaper()
+    {
+        T * instance = singularity_instance<T>::state.ptr.load(std::memory_order_relaxed);
+        if (instance != 0)
+        {
+            singularity_instance<T>::state.destroyer(instance);
+        }
+        delete singularity_instance<T>::state.declared.load(std::memory_order_relaxed);
+    }
+};
+
+// The constructor arguments stored by declare_global().
+template <class T> struct singularity_declaration
+{
+    virtual ~singularity_declaration() {}
+    virtual T * construct(void * memory) = 0;
+};
+
+// Retires the declaration being built once the instance is published.
+// Until then, the declaration stays visible, so racing callers wait on
+// the policy guard for the instance.  If the constructor throws, the
+// declaration is kept, and the next get_global() tries it again.
+template <class T> class singularity_declaration_guard
+{
+public:
+    inline singularity_declaration_guard()
+      : declared(singularity_instance<T>::state.declared.load(std::memory_order_relaxed)), built(false) {}
+    inline ~singularity_declaration_guard()
+    {
+        if (built)
+        {
+            singularity_instance<T>::state.declared.store(0, std::memory_order_release);
+            delete declared;
+        }
+    }
+    inline singularity_declaration<T> * get() const
+    {
+        return declared;
+    }
+    // Called once the instance was constructed.
+    inline void retire()
+    {
+        built = true;
+    }
+    singularity_declaration_guard(singularity_declaration_guard const &) = delete;
+    singularity_declaration_guard & operator=(singularity_declaration_guard const &) = delete;
+private:
+    singularity_declaration<T> * declared;
+    bool built;
+};
+
+template <class T> singularity_state<T> singularity_instance<T>::state;
+template <class T> singularity_reaper<T> singularity_instance<T>::reaper;
+
+// Only odr-using the reaper instantiates it, and registers its destructor.
+template <class T, bool = singularity_leak_at_exit<T>::value> struct singularity_exit
+{
+    static inline void enlist()
+    {
+        (void)&singularity_instance<T>::reaper;
+    }
+};
+
+template <class T> struct singularity_exit<T, true>
+{
+    static inline void enlist() {}
+};
+
+// The index sequence used to unpack the stored arguments of a declaration.
+template <std::size_t ...I> struct singularity_indices {};
+
+template <std::size_t N, std::size_t ...I> struct singularity_make_indices
+  : singularity_make_indices<N - 1, N - 1, I...> {};
+
+template <std::size_t ...I> struct singularity_make_indices<0, I...>
+{
+    typedef singularity_indices<I...> type;
 };
 
-template <class T> bool singularity_instance<T>::get_enabled = false;
-template <class T> std::unique_ptr<T> singularity_instance<T>::ptr(0);
+// Whether every stored argument of a declaration can be copied, so that a
+// throwing constructor leaves them intact for the next attempt.
+template <class ...A> struct singularity_copyable : std::true_type {};
+
+template <class A, class ...B> struct singularity_copyable<A, B...>
+  : std::integral_constant<bool, std::is_copy_constructible<A>::value && singularity_copyable<B...>::value> {};
+
+// The result of create_global_async(), and the construction still in
+// flight for type T.  The pointer is only read and written under the
+// policy guard, and is reset once the instance is published, or when
+// destroy() abandons the construction.
+template <class T> struct singularity_build
+{
+    std::promise<T &> promise;
+    std::shared_future<T &> future;
+};
+
+template <class T> struct singularity_pending
+{
+    static std::shared_ptr< singularity_build<T> > build;
+};
+
+template <class T> std::shared_ptr< singularity_build<T> > singularity_pending<T>::build;
+
+// The executor which destroy_async() uses unless the caller supplies
+// one, running each reclamation on a thread of its own.
+struct singularity_thread_executor
+{
+    inline void operator()(std::function<void ()> task) const
+    {
+        std::thread(std::move(task)).detach();
+    }
+};
+
+// A coroutine suspended in when_created(), which is linked into the
+// waiters of type T, and is handed the instance once it is published.
+template <class T> struct singularity_continuation
+{
+    virtual ~singularity_continuation() {}
+    virtual void resume() = 0;
+
+    singularity_continuation * next;
+    T * instance;
+};
+
+// The condition which get_global_wait_for() waits on, and the coroutines
+// suspended in when_created().  It is only constructed once a thread or
+// a coroutine waits for an instance of type T.
+template <class T> struct singularity_waiters
+{
+    singularity_waiters() : suspended(0) {}
+
+    std::mutex mutex;
+    std::condition_variable published;
+    singularity_continuation<T> * suspended;
+
+    static inline singularity_waiters & get()
+    {
+        static singularity_waiters waiters;
+        return waiters;
+    }
+};
+
+// The thread local slot of get_global_cached().  A generation of zero
+// is never published, so a new slot always misses.
+template <class T> struct singularity_cache
+{
+    T * instance;
+    unsigned long generation;
+};
+
+// A policy may nominate a lighter guard for get_global() by declaring
+// a nested read_guard type.  Otherwise the policy itself is used.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(read_guard)
+
+template <class P, bool = has_read_guard<P>::value> struct singularity_read_guard
+{
+    typedef P type;
+};
+
+template <class P> struct singularity_read_guard<P, true>
+{
+    typedef typename P::read_guard type;
+};
+
+// A policy whose readers do not block writers declares a nested
+// grace_period type, which waits in its constructor until no reader can
+// still see an instance which was unpublished.  Otherwise nothing waits.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(grace_period)
+
+struct singularity_no_grace_period {};
+
+template <class P, bool = has_grace_period<P>::value> struct singularity_grace_period
+{
+    typedef singularity_no_grace_period type;
+};
+
+template <class P> struct singularity_grace_period<P, true>
+{
+    typedef typename P::grace_period type;
+};
+
+// A policy whose read_guard excludes the writers, so that recreate() may
+// destroy the instance in place while no reader can see it, declares a
+// nested readers_exclude_writers type, whose value is true.  A policy
+// deriving from one whose readers do not hold the guard redeclares it.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(readers_exclude_writers)
+
+template <class P, bool = has_readers_exclude_writers<P>::value> struct singularity_readers_exclude_writers : std::false_type {};
+
+template <class P> struct singularity_readers_exclude_writers<P, true>
+  : std::integral_constant<bool, P::readers_exclude_writers::value> {};
+
+// A policy which may be used from several threads at once declares a
+// nested thread_safe type, whose value is true.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(thread_safe)
+
+template <class P, bool = has_thread_safe<P>::value> struct singularity_thread_safe : std::false_type {};
+
+template <class P> struct singularity_thread_safe<P, true>
+  : std::integral_constant<bool, P::thread_safe::value> {};
+
+// A policy which measures singularity declares a nested instrumentation
+// type.  It is told when each instance is about to be constructed, when
+// it was constructed and destroyed, and when it is looked up.  Otherwise
+// every hook is an empty inline function, and compiles to nothing.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(instrumentation)
+
+struct singularity_no_instrumentation
+{
+    struct stamp {};
+    static inline stamp start()
+    {
+        return stamp();
+    }
+    static inline void constructed(stamp) {}
+    static inline void destroyed(stamp) {}
+    static inline void accessed() {}
+};
+
+template <class P, bool = has_instrumentation<P>::value> struct singularity_instrumentation
+{
+    typedef singularity_no_instrumentation type;
+};
+
+template <class P> struct singularity_instrumentation<P, true>
+{
+    typedef typename P::instrumentation type;
+};
+
+// A storage policy which shares the instance with other processes declares
+// a nested attachment type.  It tells whether another process created the
+// instance, maps the instance of that process, records the instances
+// published by this process, and tells whether this process owns the
+// instance it holds.  Otherwise there is nothing to attach to.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(attachment)
+
+template <class T> struct singularity_no_attachment
+{
+    static inline bool exists()
+    {
+        return false;
+    }
+    static inline T* attach()
+    {
+        return 0;
+    }
+    static inline void detach(T *) {}
+    static inline bool owned(T *)
+    {
+        return true;
+    }
+    static inline void published(T *) {}
+};
+
+template <class P, class T, bool = has_attachment<P>::value> struct singularity_attachment
+{
+    typedef singularity_no_attachment<T> type;
+};
+
+template <class P, class T> struct singularity_attachment<P, T, true>
+{
+    typedef typename P::attachment type;
+};
+
+// Writes and maps the images of save_snapshot() and create_from_snapshot(),
+// and is defined by singularity_cpp11_snapshot.hpp.
+template <class T> struct singularity_image;
+
+// The awaitable of when_created(), which is defined by
+// singularity_cpp11_coroutine.hpp.
+template <class T, class Executor> class singularity_awaiter;
+
+// Constructs a group of singularities in one block for create_all(), and
+// is defined by singularity_cpp11_batch.hpp.
+template <class ...S> struct singularity_batch;
 
 } // detail namespace
 
-template <class T, template <class T> class M = single_threaded>
+// The access tags are the last template argument of singularity.  With
+// selectable_access, calling create() or create_global() decides at
+// runtime whether get_global() may be used.  With global_access, only
+// create_global() is available, so get_global() performs no check.
+struct selectable_access {};
+struct global_access {};
+
+template <class T, template <class> class M = single_threaded, template <class> class S = heap_storage, class G = selectable_access>
 class singularity
 {
 public:
+    // Returns 0 instead of throwing when the instance already exists.
     template <class ...A>
-    static inline T& create(A && ...args)
+    static inline T* try_create(A && ...args)
     {
+        verify_create_allowed();
+
         M<T> guard;
         (void)guard;
 
-        verify_not_created();
+        if (is_created())
+        {
+            return 0;
+        }
 
-        detail::singularity_instance<T>::get_enabled = false;
-        detail::singularity_instance<T>::ptr.reset(new T(std::forward<A>(args)...));
-        return *detail::singularity_instance<T>::ptr;
+        typename instrumentation::stamp const started = instrumentation::start();
+        detail::singularity_storage_guard< S<T> > storage;
+        T * instance = new (storage.get()) T(std::forward<A>(args)...);
+        storage.release();
+        instrumentation::constructed(started);
+        return publish(instance, false);
+    }
+
+    template <class ...A>
+    static inline T* try_create_global(A && ...args)
+    {
+        M<T> guard;
+        (void)guard;
+
+        if (is_created())
+        {
+            return 0;
+        }
+
+        typename instrumentation::stamp const started = instrumentation::start();
+        detail::singularity_storage_guard< S<T> > storage;
+        T * instance = new (storage.get()) T(std::forward<A>(args)...);
+        storage.release();
+        instrumentation::constructed(started);
+        return publish(instance, true);
+    }
+
+    template <class ...A>
+    static inline T& create(A && ...args)
+    {
+        return verify_not_created(try_create(std::forward<A>(args)...));
     }
 
     template <class ...A>
     static inline T& create_global(A && ...args)
     {
+        return verify_not_created(try_create_global(std::forward<A>(args)...));
+    }
+
+    // Returns the global instance, and constructs it from the arguments
+    // first if there is none, so racing threads construct it exactly once
+    // without catching singularity_already_created.  Once the instance is
+    // published, this is a single acquire load, without the policy guard.
+    // While create_global_async() is constructing the instance, this waits
+    // for it, and throws what its future throws if the construction fails.
+    // Throws singularity_no_global_access if it was created by create().
+    template <class ...A>
+    static inline T& create_or_get_global(A && ...args)
+    {
+        instrumentation::accessed();
+
+        T * instance = lookup_global(G());
+        if (instance != 0)
+        {
+            return *instance;
+        }
+
+        std::shared_future<T&> pending;
+        {
+            M<T> guard;
+            (void)guard;
+
+            if (!is_created())
+            {
+                typename instrumentation::stamp const started = instrumentation::start();
+                detail::singularity_storage_guard< S<T> > storage;
+                instance = new (storage.get()) T(std::forward<A>(args)...);
+                storage.release();
+                instrumentation::constructed(started);
+                return *publish(instance, true);
+            }
+            instance = lookup_global(G());
+            if (instance == 0 && detail::singularity_pending<T>::build)
+            {
+                pending = detail::singularity_pending<T>::build->future;
+            }
+        }
+
+        // The guard is released before waiting, so the build can publish.
+        if (pending.valid())
+        {
+            return pending.get();
+        }
+
+        // The instance was declared, or lives in another process.
+        return instance != 0 ? *instance : get_global();
+    }
+
+    // Stores the constructor arguments, moving or copying each of them
+    // as std::thread does, so a reference must be wrapped in std::ref().
+    // The instance is built with global access by the first call to
+    // get_global(), exactly once, even when several threads race.  If the
+    // constructor throws, so does get_global().  When every argument can
+    // be copied, the constructor only receives copies, and the next call
+    // builds the instance again.  Otherwise the arguments were moved, and
+    // every later call throws the same exception, until destroy() discards
+    // the declaration.
+    template <class ...A>
+    static inline void declare_global(A && ...args)
+    {
+        M<T> guard;
+        (void)guard;
+
+        if (is_created())
+        {
+            BOOST_THROW_EXCEPTION(singularity_already_created());
+        }
+
+        detail::singularity_exit<T>::enlist();
+        detail::singularity_instance<T>::state.declared.store(
+            new declaration<typename std::decay<A>::type...>(std::forward<A>(args)...),
+            std::memory_order_release);
+    }
+
+    // Constructs the instance with global access on a thread of its own,
+    // and returns at once.  Until the instance is published, it counts as
+    // created, so another create() still throws already_created, while
+    // try_get_global() returns 0, and try_get_global_for() and
+    // get_global_wait() wait for it.  The
+    // future holds the exception of a constructor which threw, or
+    // singularity_not_created if destroy() was called in the meantime.
+    // An abandoned build still finishes after a new instance may have been
+    // created, so both must have memory of their own.
+    template <class ...A>
+    static inline std::shared_future<T&> create_global_async(A && ...args)
+    {
+        static_assert(detail::singularity_thread_safe< M<T> >::value,
+            "create_global_async() requires a thread-safe policy");
+        static_assert(!std::is_same< S<T>, static_storage<T> >::value,
+            "create_global_async() requires a storage policy which can hold two instances");
+
+        std::shared_ptr< detail::singularity_build<T> > build =
+            std::make_shared< detail::singularity_build<T> >();
+        build->future = build->promise.get_future().share();
+
         M<T> guard;
         (void)guard;
 
-        verify_not_created();
+        if (is_created())
+        {
+            BOOST_THROW_EXCEPTION(singularity_already_created());
+        }
 
-        detail::singularity_instance<T>::get_enabled = true;
-        detail::singularity_instance<T>::ptr.reset(new T(std::forward<A>(args)...));
-        return *detail::singularity_instance<T>::ptr;
+        // The thread waits for the guard before it publishes the instance.
+        std::thread(&build_async<typename std::decay<A>::type...>, build, std::forward<A>(args)...).detach();
+        detail::singularity_pending<T>::build = build;
+        detail::singularity_instance<T>::state.ptr.enable_global();
+        return build->future;
     }
 
     static inline void destroy()
@@ -121,45 +724,762 @@ public:
         M<T> guard;
         (void)guard;
 
-        if (detail::singularity_instance<T>::ptr.get() == 0)
+        T * instance = detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed);
+        if (instance == 0)
+        {
+            discard_unbuilt();
+            return;
+        }
+
+        detail::singularity_instance<T>::state.ptr.store(0, std::memory_order_release);
+        detail::singularity_instance<T>::state.generation.fetch_add(1, std::memory_order_release);
+        wait_for_readers();
+        detail::singularity_instance<T>::state.destroyer(instance);
+    }
+
+    // Constructs a new instance, without holding the policy guard, and
+    // publishes it in place of the current one, so get_global() never
+    // fails in between.  With rcu_multi_threaded, the current instance is
+    // destroyed once every global_reader which may still use it is gone.
+    // Throws singularity_not_created if there is no instance to replace.
+    template <class ...A>
+    static inline T& replace(A && ...args)
+    {
+        verify_replace_allowed();
+
+        typename instrumentation::stamp const started = instrumentation::start();
+        detail::singularity_storage_guard< S<T> > storage;
+        T * replacement = new (storage.get()) T(std::forward<A>(args)...);
+        storage.release();
+        instrumentation::constructed(started);
+        return replace_instance(replacement);
+    }
+
+    // Destroys the instance and constructs a new one in the same memory,
+    // under a single acquisition of the policy guard, so the storage
+    // policy is never involved and the instance is never unpublished.
+    // Readers are excluded only by the guard, so policies whose readers
+    // do not take it are refused; replace() serves those.  The arguments
+    // must not refer to the instance.  If the constructor throws, the
+    // instance is gone as after destroy().  Throws singularity_not_created
+    // if there is no instance to recreate.
+    template <class ...A>
+    static inline T& recreate(A && ...args)
+    {
+        verify_recreate_allowed();
+
+        M<T> guard;
+        (void)guard;
+
+        T * instance = destroy_in_place();
+        try
+        {
+            typename instrumentation::stamp const started = instrumentation::start();
+            new (instance) T(std::forward<A>(args)...);
+            instrumentation::constructed(started);
+        }
+        catch (...)
+        {
+            abandon_in_place(instance);
+            throw;
+        }
+        return *instance;
+    }
+
+    // Writes the image of the instance to the file at path, for a later
+    // create_from_snapshot().  Requires singularity_cpp11_snapshot.hpp,
+    // and a type which opts in through singularity_snapshot<T>.
+    static inline void save_snapshot(char const * path)
+    {
+        M<T> guard;
+        (void)guard;
+
+        T * instance = detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed);
+        if (instance == 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_not_created());
+        }
+        detail::singularity_image<T>::save(*instance, path);
+    }
+
+    // Maps the image written by save_snapshot(), and publishes it with
+    // global access in place of constructing T.  Its pages are only read
+    // from the file when first touched, and destroy() unmaps it again.
+    static inline T& create_from_snapshot(char const * path)
+    {
+        M<T> guard;
+        (void)guard;
+
+        if (is_created())
         {
-            BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+            BOOST_THROW_EXCEPTION(singularity_already_created());
         }
+        return *adopt(detail::singularity_image<T>::map(path), true,
+                      &detail::singularity_image<T>::unmap, &detail::singularity_image<T>::unmap);
+    }
+
+    // Unpublishes the instance at once, so new lookups fail as after
+    // destroy(), and hands its destruction to the executor, which is
+    // any callable accepting a std::function<void ()>.  The destructor
+    // therefore never runs under the policy guard, nor on the calling
+    // thread, and the future becomes ready once it has finished.
+    static inline std::future<void> destroy_async()
+    {
+        return destroy_async(detail::singularity_thread_executor());
+    }
+
+    template <class Executor>
+    static inline std::future<void> destroy_async(Executor && executor)
+    {
+        static_assert(!std::is_same< S<T>, static_storage<T> >::value,
+            "destroy_async() requires a storage policy which can hold two instances");
+
+        std::shared_ptr< std::promise<void> > reclaimed = std::make_shared< std::promise<void> >();
+        std::future<void> future = reclaimed->get_future();
+
+        T * instance = 0;
+        void (*destroyer)(T *) = 0;
+        {
+            M<T> guard;
+            (void)guard;
+
+            instance = detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed);
+            if (instance == 0)
+            {
+                discard_unbuilt();
+                reclaimed->set_value();
+                return future;
+            }
+
+            destroyer = detail::singularity_instance<T>::state.destroyer;
+            detail::singularity_instance<T>::state.ptr.store(0, std::memory_order_release);
+            detail::singularity_instance<T>::state.generation.fetch_add(1, std::memory_order_release);
+        }
+
+        executor(std::function<void ()>([instance, destroyer, reclaimed]
+        {
+            {
+                M<T> guard;
+                (void)guard;
 
-        delete detail::singularity_instance<T>::ptr.get();
-        detail::singularity_instance<T>::ptr.reset();
+                wait_for_readers();
+            }
+            destroyer(instance);
+            reclaimed->set_value();
+        }));
+        return future;
     }
 
     static inline T& get_global()
     {
+        return verify_global(try_get_global());
+    }
+
+    // Returns 0 instead of throwing when the instance was not created,
+    // or was created without global access.
+    static inline T* try_get_global()
+    {
+        instrumentation::accessed();
+
+        T * instance = lookup_global_guarded();
+        if (instance == 0)
+        {
+            instance = build_declared();
+        }
+        if (instance == 0)
+        {
+            instance = attach_published();
+        }
+        return instance;
+    }
+
+    // Blocks until the instance is accessible, instead of throwing.  With
+    // C++20 the thread sleeps on the generation of the instance, so each
+    // create() wakes every waiter with a single notification.  It is still
+    // counted as waiting, though publish() does not need it to wake it.
+    static inline T& get_global_wait()
+    {
+#if defined(__cpp_lib_atomic_wait)
+        for (;;)
+        {
+            unsigned long const generation =
+                detail::singularity_instance<T>::state.generation.load(std::memory_order_acquire);
+            T * instance = try_get_global();
+            if (instance != 0)
+            {
+                return *instance;
+            }
+            detail::singularity_instance<T>::state.waiting.fetch_add(1, std::memory_order_relaxed);
+            detail::singularity_instance<T>::state.generation.wait(generation, std::memory_order_acquire);
+            detail::singularity_instance<T>::state.waiting.fetch_sub(1, std::memory_order_relaxed);
+        }
+#else
+        return *wait_global(0);
+#endif
+    }
+
+    // Blocks at most for the timeout, and returns 0 if the instance is
+    // still not accessible by then.
+    template <class Rep, class Period>
+    static inline T* get_global_wait_for(std::chrono::duration<Rep, Period> const & timeout)
+    {
+        std::chrono::steady_clock::time_point const deadline = std::chrono::steady_clock::now()
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+        return wait_global(&deadline);
+    }
+
+    // Waits up to the timeout for a construction started by
+    // create_global_async(), and returns 0 if the instance is still not
+    // accessible.  Without a construction in flight, it does not wait,
+    // unlike get_global_wait_for().
+    template <class Rep, class Period>
+    static inline T* try_get_global_for(std::chrono::duration<Rep, Period> const & timeout)
+    {
+        T * instance = try_get_global();
+        if (instance == 0)
+        {
+            std::shared_future<T&> pending;
+            {
+                M<T> guard;
+                (void)guard;
+
+                if (detail::singularity_pending<T>::build)
+                {
+                    pending = detail::singularity_pending<T>::build->future;
+                }
+            }
+            if (pending.valid() && pending.wait_for(timeout) == std::future_status::ready)
+            {
+                instance = try_get_global();
+            }
+        }
+        return instance;
+    }
+
+    // Returns an awaitable, which is ready at once when the instance is
+    // accessible, and otherwise suspends the coroutine until the instance
+    // is published with global access, then resumes it through the
+    // executor, which is any callable accepting a std::function<void ()>.
+    // The executor is called under the policy guard, so it should only
+    // schedule the coroutine.  By default, it resumes on a thread of its
+    // own.  Requires singularity_cpp11_coroutine.hpp, and C++20.
+    static inline detail::singularity_awaiter<T, detail::singularity_thread_executor> when_created()
+    {
+        return when_created(detail::singularity_thread_executor());
+    }
+
+    template <class Executor>
+    static inline detail::singularity_awaiter<T, typename std::decay<Executor>::type> when_created(Executor && executor)
+    {
+        return detail::singularity_awaiter<T, typename std::decay<Executor>::type>(
+            std::forward<Executor>(executor), &lookup_published, &try_get_global);
+    }
+
+    // Only asserts, in debug builds, that the instance is accessible.
+    // With single_threaded, this is a single load of the instance pointer.
+    // Unlike get_global(), an instance which was declared is not built.
+    static inline T& get_global_unchecked()
+    {
+        typename detail::singularity_read_guard< M<T> >::type guard;
+        (void)guard;
+
+        instrumentation::accessed();
+        BOOST_ASSERT(lookup_global(G()) != 0);
+        return *detail::singularity_instance<T>::state.ptr.load(std::memory_order_acquire);
+    }
+
+    // Keeps the instance in a slot local to the calling thread, which is
+    // only looked up again after the generation of the instance changes.
+    // Repeated calls therefore read one shared word, and never take the
+    // policy guard.  The word is advanced by every path which publishes,
+    // replaces or destroys the instance: create() and the other creators,
+    // the build of create_global_async(), replace(), recreate() when it
+    // abandons the instance, destroy() and destroy_async().
+    // The cached reference is not covered by the grace period of replace().
+    static inline T& get_global_cached()
+    {
+        static thread_local detail::singularity_cache<T> slot;
+
+        unsigned long const generation =
+            detail::singularity_instance<T>::state.generation.load(std::memory_order_acquire);
+        if (slot.generation != generation)
+        {
+            slot.instance = &get_global();
+            slot.generation = generation;
+        }
+        return *slot.instance;
+    }
+
+    // Holds the read guard of the policy for as long as it lives, so
+    // with a shared_multi_threaded policy, destroy() cannot run while
+    // the instance is being used.  Do not call get_global() or any
+    // other member of singularity while a global_reader is alive.
+    // An instance which was declared must first be built by get_global().
+    class global_reader
+    {
+    public:
+        inline global_reader() : instance(verify_global(lookup_global(G())))
+        {
+            instrumentation::accessed();
+        }
+        inline T& operator*() const
+        {
+            return instance;
+        }
+        inline T* operator->() const
+        {
+            return &instance;
+        }
+        global_reader(global_reader const &) = delete;
+        global_reader & operator=(global_reader const &) = delete;
+    private:
+        typename detail::singularity_read_guard< M<T> >::type guard;
+        T & instance;
+    };
+private:
+    template <class ...> friend struct detail::singularity_batch;
+
+    typedef typename detail::singularity_instrumentation< M<T> >::type instrumentation;
+    typedef typename detail::singularity_attachment< S<T>, T >::type attachment;
+
+    // Keeps the arguments of declare_global() as by std::thread, moving
+    // them into the constructor of T when the instance is built.
+    template <class ...A> class declaration : public detail::singularity_declaration<T>
+    {
+    public:
+        template <class ...U>
+        explicit declaration(U && ...args) : arguments(std::forward<U>(args)...) {}
+        virtual T * construct(void * memory)
+        {
+            if (failure)
+            {
+                std::rethrow_exception(failure);
+            }
+            return construct_from(memory, typename detail::singularity_make_indices<sizeof...(A)>::type(),
+                                  typename detail::singularity_copyable<A...>::type());
+        }
+    private:
+        // Passes copies, so the arguments survive a throwing constructor.
+        template <std::size_t ...I>
+        T * construct_from(void * memory, detail::singularity_indices<I...>, std::true_type)
+        {
+            return new (memory) T(A(std::get<I>(arguments))...);
+        }
+
+        // Moves the arguments, which a throwing constructor may have
+        // consumed, so its exception is kept and thrown to every later call.
+        template <std::size_t ...I>
+        T * construct_from(void * memory, detail::singularity_indices<I...>, std::false_type)
+        {
+            try
+            {
+                return new (memory) T(std::move(std::get<I>(arguments))...);
+            }
+            catch (...)
+            {
+                failure = std::current_exception();
+                throw;
+            }
+        }
+
+        std::tuple<A...> arguments;
+        std::exception_ptr failure;
+    };
+
+    static inline T* lookup_global(selectable_access)
+    {
+        return detail::singularity_instance<T>::state.ptr.load_global();
+    }
+
+    static inline T* lookup_global(global_access)
+    {
+        return detail::singularity_instance<T>::state.ptr.load(std::memory_order_acquire);
+    }
+
+    // The lookup of when_created(), which never takes the guard.
+    static inline T* lookup_published()
+    {
+        return lookup_global(G());
+    }
+
+    static inline T* lookup_global_guarded()
+    {
+        typename detail::singularity_read_guard< M<T> >::type guard;
+        (void)guard;
+
+        return lookup_global(G());
+    }
+
+    // Builds the declared instance under the policy guard.  Callers which
+    // lose the race find the instance published once they acquire it.
+    // Without a declaration, this only repeats the lookup, because the
+    // declaration is retired after the instance was published.
+    static inline T* build_declared()
+    {
+        if (detail::singularity_instance<T>::state.declared.load(std::memory_order_acquire) == 0)
+        {
+            return lookup_global_guarded();
+        }
+
         M<T> guard;
         (void)guard;
 
-        if (detail::singularity_instance<T>::get_enabled == false) {
+        detail::singularity_declaration_guard<T> declared;
+        if (declared.get() == 0)
+        {
+            return lookup_global(G());
+        }
+
+        typename instrumentation::stamp const started = instrumentation::start();
+        detail::singularity_storage_guard< S<T> > storage;
+        T * instance = declared.get()->construct(storage.get());
+        storage.release();
+        declared.retire();
+        instrumentation::constructed(started);
+        return publish(instance, true);
+    }
+
+    // Layers the throwing get_global() on top of lookup_global().
+    static inline T& verify_global(T * instance)
+    {
+        if (instance == 0)
+        {
+            throw_not_global(G());
+        }
+        return *instance;
+    }
+
+    static inline void throw_not_global(selectable_access)
+    {
+        if (!detail::singularity_instance<T>::state.ptr.global_enabled()) {
             BOOST_THROW_EXCEPTION(singularity_no_global_access());
         }
+        BOOST_THROW_EXCEPTION(singularity_not_created());
+    }
+
+    static inline void throw_not_global(global_access)
+    {
+        BOOST_THROW_EXCEPTION(singularity_not_created());
+    }
+
+    static inline void verify_create_allowed()
+    {
+        static_assert(!std::is_same<G, global_access>::value,
+            "create() is unavailable with global_access, use create_global()");
+    }
+
+    // Rechecks the instance without the policy guard whenever publish()
+    // wakes the waiters, so the guard is never taken under their mutex.
+    // The increment of the waiting count pairs with the read-modify-write
+    // in publish(), so either the waiter sees the instance, or publish()
+    // sees the waiter.  Unlike fences, ThreadSanitizer understands both.
+    static inline T* wait_global(std::chrono::steady_clock::time_point const * deadline)
+    {
+        detail::singularity_waiters<T> & waiters = detail::singularity_waiters<T>::get();
+        for (;;)
+        {
+            T * instance = try_get_global();
+            if (instance != 0)
+            {
+                return instance;
+            }
+
+            std::unique_lock<std::mutex> lock(waiters.mutex);
+            detail::singularity_instance<T>::state.waiting.fetch_add(1, std::memory_order_acq_rel);
+            bool timed_out = false;
+            while (lookup_global(G()) == 0 && !timed_out)
+            {
+                if (deadline == 0)
+                {
+                    waiters.published.wait(lock);
+                }
+                else
+                {
+                    timed_out = waiters.published.wait_until(lock, *deadline) == std::cv_status::timeout;
+                }
+            }
+            detail::singularity_instance<T>::state.waiting.fetch_sub(1, std::memory_order_relaxed);
+            if (timed_out)
+            {
+                lock.unlock();
+                return try_get_global();
+            }
+        }
+    }
+
+    // An instance which was declared, or is being constructed by
+    // create_global_async(), counts as created.
+    static inline void verify_replace_allowed()
+    {
+        static_assert(!std::is_same< S<T>, static_storage<T> >::value,
+            "replace() requires a storage policy which can hold two instances");
+        static_assert(!detail::has_attachment< S<T> >::value,
+            "replace() cannot swap an instance which other processes attached to");
+    }
+
+    static inline void verify_recreate_allowed()
+    {
+        static_assert(detail::singularity_readers_exclude_writers< M<T> >::value,
+            "recreate() requires a policy whose readers hold the guard; use replace()");
+        static_assert(!detail::has_attachment< S<T> >::value,
+            "recreate() cannot rebuild an instance which other processes attached to");
+    }
 
-        if (detail::singularity_instance<T>::ptr.get() == 0)
+    // Runs the destructor of the published instance, which stays published
+    // because the caller holds the guard until a new one is constructed.
+    static inline T* destroy_in_place()
+    {
+        T * instance = detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed);
+        if (instance == 0)
         {
             BOOST_THROW_EXCEPTION(singularity_not_created());
         }
 
-        return *detail::singularity_instance<T>::ptr;
+        typename instrumentation::stamp const started = instrumentation::start();
+        instance->~T();
+        instrumentation::destroyed(started);
+        return instance;
     }
-private:
-    static inline void verify_not_created()
+
+    // Unpublishes the memory of an instance which failed to be recreated.
+    // Its destructor already ran, so only the deallocator recorded with
+    // the destroyer returns the memory, without running it again.
+    static inline void abandon_in_place(T * instance)
     {
-        if (detail::singularity_instance<T>::ptr.get() != 0)
+        void (*deallocator)(T *) = detail::singularity_instance<T>::state.deallocator;
+        detail::singularity_instance<T>::state.ptr.store(0, std::memory_order_release);
+        detail::singularity_instance<T>::state.generation.fetch_add(1, std::memory_order_release);
+        deallocator(instance);
+    }
+
+    // A declaration which was never built is simply discarded, and a
+    // construction still in flight is abandoned.  Without either, there
+    // is nothing left to destroy.
+    static inline void discard_unbuilt()
+    {
+        detail::singularity_declaration<T> * declared =
+            detail::singularity_instance<T>::state.declared.exchange(0, std::memory_order_relaxed);
+        if (declared != 0)
+        {
+            delete declared;
+            return;
+        }
+        if (detail::singularity_pending<T>::build)
+        {
+            detail::singularity_pending<T>::build.reset();
+            return;
+        }
+        BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+    }
+
+    static inline void wait_for_readers()
+    {
+        typename detail::singularity_grace_period< M<T> >::type grace_period;
+        (void)grace_period;
+    }
+
+    // Publishes the replacement in place of the current instance, which
+    // keeps its access, and destroys the current instance only once the
+    // grace period of the policy has passed.
+    static inline T& replace_instance(T * replacement)
+    {
+        M<T> guard;
+        (void)guard;
+
+        T * instance = detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed);
+        if (instance == 0)
+        {
+            release(replacement);
+            BOOST_THROW_EXCEPTION(singularity_not_created());
+        }
+
+        void (*destroyer)(T *) = detail::singularity_instance<T>::state.destroyer;
+        detail::singularity_instance<T>::state.destroyer = &release;
+        detail::singularity_instance<T>::state.deallocator = &deallocate;
+        detail::singularity_instance<T>::state.ptr.store(replacement, std::memory_order_release);
+        detail::singularity_instance<T>::state.generation.fetch_add(1, std::memory_order_release);
+        wait_for_readers();
+        destroyer(instance);
+        return *replacement;
+    }
+
+    static inline bool is_created()
+    {
+        return detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed) != 0
+            || detail::singularity_instance<T>::state.declared.load(std::memory_order_relaxed) != 0
+            || detail::singularity_pending<T>::build
+            || attachment::exists();
+    }
+
+    // Publishes the instance which another process created, if the storage
+    // policy found one.  Destroying it only detaches this process from it.
+    static inline T* attach_published()
+    {
+        if (!detail::has_attachment< S<T> >::value)
+        {
+            return 0;
+        }
+
+        M<T> guard;
+        (void)guard;
+
+        if (detail::singularity_instance<T>::state.ptr.load(std::memory_order_relaxed) != 0)
+        {
+            return lookup_global(G());
+        }
+
+        T * instance = attachment::attach();
+        if (instance == 0)
+        {
+            return 0;
+        }
+        adopt(instance, true, &attachment::detach, &attachment::detach);
+        return instance;
+    }
+
+    // Runs on the thread started by create_global_async().  The instance
+    // is constructed outside of the guard, and only published if destroy()
+    // did not abandon the construction meanwhile.
+    template <class ...A>
+    static void build_async(std::shared_ptr< detail::singularity_build<T> > build, A ...args)
+    {
+        T * instance = 0;
+        std::exception_ptr failure;
+        try
+        {
+            typename instrumentation::stamp const started = instrumentation::start();
+            detail::singularity_storage_guard< S<T> > storage;
+            instance = new (storage.get()) T(std::move(args)...);
+            storage.release();
+            instrumentation::constructed(started);
+        }
+        catch (...)
+        {
+            failure = std::current_exception();
+        }
+
+        {
+            M<T> guard;
+            (void)guard;
+
+            if (detail::singularity_pending<T>::build != build)
+            {
+                if (instance != 0)
+                {
+                    release(instance);
+                }
+                failure = std::make_exception_ptr(singularity_not_created());
+            }
+            else
+            {
+                detail::singularity_pending<T>::build.reset();
+                if (instance != 0)
+                {
+                    publish(instance, true);
+                }
+            }
+        }
+
+        if (failure)
+        {
+            build->promise.set_exception(failure);
+        }
+        else
+        {
+            build->promise.set_value(*instance);
+        }
+    }
+
+    // Layers the throwing create functions on top of the try_ functions.
+    static inline T& verify_not_created(T * instance)
+    {
+        if (instance == 0)
         {
             BOOST_THROW_EXCEPTION(singularity_already_created());
         }
+        return *instance;
+    }
+
+    // A global instance is also recorded for the other processes, when
+    // the storage policy shares it with them.
+    static inline T* publish(T * instance, bool global)
+    {
+        if (global)
+        {
+            attachment::published(instance);
+        }
+        return adopt(instance, global, &release, &deallocate);
+    }
+
+    // The waiting count is read with a read-modify-write, which pairs with
+    // wait_global() and when_created().  The suspended coroutines are only
+    // resumed once their mutex is released, and only by a global instance.
+    static inline T* adopt(T * instance, bool global, void (*destroyer)(T *), void (*deallocator)(T *))
+    {
+        detail::singularity_exit<T>::enlist();
+        detail::singularity_instance<T>::state.destroyer = destroyer;
+        detail::singularity_instance<T>::state.deallocator = deallocator;
+        detail::singularity_instance<T>::state.ptr.publish(instance, global);
+        detail::singularity_instance<T>::state.generation.fetch_add(1, std::memory_order_release);
+#if defined(__cpp_lib_atomic_wait)
+        detail::singularity_instance<T>::state.generation.notify_all();
+#endif
+        if (detail::singularity_instance<T>::state.waiting.fetch_add(0, std::memory_order_acq_rel) != 0)
+        {
+            detail::singularity_waiters<T> & waiters = detail::singularity_waiters<T>::get();
+            detail::singularity_continuation<T> * resumed = 0;
+            {
+                std::lock_guard<std::mutex> lock(waiters.mutex);
+                waiters.published.notify_all();
+                if (global)
+                {
+                    resumed = waiters.suspended;
+                    waiters.suspended = 0;
+                }
+                for (detail::singularity_continuation<T> * c = resumed; c != 0; c = c->next)
+                {
+                    c->instance = instance;
+                    detail::singularity_instance<T>::state.waiting.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+            // A coroutine may finish, and free its continuation, once resumed.
+            while (resumed != 0)
+            {
+                detail::singularity_continuation<T> * const next = resumed->next;
+                resumed->resume();
+                resumed = next;
+            }
+        }
+        return instance;
+    }
+
+    // Destroys the instance in place and returns its memory to the
+    // storage policy which supplied it.  A process which shares the
+    // instance without owning it only detaches from it.
+    static inline void release(T * instance)
+    {
+        if (!attachment::owned(instance))
+        {
+            attachment::detach(instance);
+            return;
+        }
+        typename instrumentation::stamp const started = instrumentation::start();
+        instance->~T();
+        S<T>::deallocate(instance);
+        instrumentation::destroyed(started);
+    }
+
+    // Returns the memory of an instance whose destructor already ran.
+    static inline void deallocate(T * instance)
+    {
+        S<T>::deallocate(instance);
     }
 };
 
 // Convenience macro which generates the required friend statement
 // for use inside classes which are created by singularity.
 #define FRIEND_CLASS_SINGULARITY \
-    template <class T, template <class T> class M> friend class singularity
+    template <class T, template <class> class M, template <class> class S, class G> friend class singularity
 
 } // boost namespace
 
@@ -0,0 +1,255 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Creates a group of global singularities in one block of memory.
+//!
+//! ::create_all() acquires the guard of every singularity of the group, in
+//! the order they are listed, and constructs each instance in turn in a
+//! single allocation, in place of their storage policies.  If any of them
+//! already exists, or any constructor throws, none is published.  Otherwise
+//! all are published together, with global access.  ::destroy_all()
+//! destroys them in the reverse order, and the block is freed once its
+//! last instance is destroyed, however that instance is destroyed.
+//----------------------------------------------------------------------------
+//  typedef singularity<Config, multi_threaded> config;
+//  typedef singularity<Database, multi_threaded> database;
+//
+//  create_all<config, database>(std::make_tuple("service.conf"),
+//                               std::forward_as_tuple(pool));
+//  destroy_all<config, database>();
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_BATCH_HPP
+#define SINGULARITY_CPP11_BATCH_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <boost/throw_exception.hpp>
+
+#include <singularity_cpp11.hpp>
+
+namespace boost {
+
+namespace detail {
+
+template <class S> struct singularity_member;
+
+template <class T, template <class> class M, template <class> class S, class G>
+struct singularity_member< singularity<T, M, S, G> >
+{
+    typedef T type;
+    typedef M<T> guard;
+};
+
+// Holds the guard of every singularity of the group, acquired in order.
+template <class ...S> struct singularity_batch_guard {};
+
+template <class H, class ...R> struct singularity_batch_guard<H, R...>
+{
+    typename singularity_member<H>::guard guard;
+    singularity_batch_guard<R...> rest;
+};
+
+// The block starts with the count of its instances which still live.
+struct singularity_block_header
+{
+    explicit singularity_block_header(std::size_t instances) : live(instances) {}
+    std::atomic<std::size_t> live;
+};
+
+// Places instance I of the group after the one before it, at its own
+// alignment, and the first one after the header.
+template <std::size_t I, class ...S> struct singularity_slot
+{
+    typedef typename std::tuple_element< I, std::tuple<S...> >::type singularity_type;
+    typedef typename singularity_member<singularity_type>::type type;
+
+    static std::size_t const alignment = singularity_alignment<type>::value;
+    static std::size_t const offset =
+        (singularity_slot<I - 1, S...>::end + alignment - 1) / alignment * alignment;
+    static std::size_t const end = offset + sizeof(type);
+
+    static_assert(alignment <= std::alignment_of<std::max_align_t>::value,
+        "the block cannot align the type");
+};
+
+template <class ...S> struct singularity_slot<0, S...>
+{
+    typedef typename std::tuple_element< 0, std::tuple<S...> >::type singularity_type;
+    typedef typename singularity_member<singularity_type>::type type;
+
+    static std::size_t const alignment = singularity_alignment<type>::value;
+    static std::size_t const offset =
+        (sizeof(singularity_block_header) + alignment - 1) / alignment * alignment;
+    static std::size_t const end = offset + sizeof(type);
+
+    static_assert(alignment <= std::alignment_of<std::max_align_t>::value,
+        "the block cannot align the type");
+};
+
+template <class ...S> struct singularity_batch
+{
+    typedef std::tuple<typename singularity_member<S>::type &...> references;
+    typedef typename singularity_make_indices<sizeof...(S)>::type indices;
+
+    static std::size_t const size = singularity_slot<sizeof...(S) - 1, S...>::end;
+
+    template <class ...P>
+    static inline references create(P && ...arguments)
+    {
+        singularity_batch_guard<S...> guard;
+        (void)guard;
+
+        bool const created[] = { S::is_created()... };
+        for (std::size_t i = 0; i < sizeof...(S); ++i)
+        {
+            if (created[i])
+            {
+                BOOST_THROW_EXCEPTION(singularity_already_created());
+            }
+        }
+
+        char * block = static_cast<char *>(::operator new(size));
+        try
+        {
+            construct<0>(block, std::forward<P>(arguments)...);
+        }
+        catch (...)
+        {
+            ::operator delete(block);
+            throw;
+        }
+        new (block) singularity_block_header(sizeof...(S));
+        return publish(block, indices());
+    }
+
+    // Reports whether any instance of the group was destroyed.
+    static inline bool destroy(singularity_indices<>)
+    {
+        return false;
+    }
+
+    template <std::size_t I, std::size_t ...R>
+    static inline bool destroy(singularity_indices<I, R...>)
+    {
+        bool destroyed = true;
+        try
+        {
+            singularity_slot<sizeof...(S) - 1 - I, S...>::singularity_type::destroy();
+        }
+        catch (singularity_already_destroyed const &)
+        {
+            destroyed = false;
+        }
+        return destroy(singularity_indices<R...>()) || destroyed;
+    }
+private:
+    // Constructs each instance in its slot, and destroys those before it
+    // in the reverse order if a constructor throws.
+    template <std::size_t I>
+    static inline void construct(char *) {}
+
+    template <std::size_t I, class H, class ...R>
+    static inline void construct(char * block, H && arguments, R && ...rest)
+    {
+        typedef typename singularity_slot<I, S...>::type type;
+        type * instance = construct_from<type>(slot<I>(block),
+            std::forward<H>(arguments),
+            typename singularity_make_indices<std::tuple_size<typename std::decay<H>::type>::value>::type());
+        try
+        {
+            construct<I + 1>(block, std::forward<R>(rest)...);
+        }
+        catch (...)
+        {
+            instance->~type();
+            throw;
+        }
+    }
+
+    template <class T, class A, std::size_t ...I>
+    static inline T* construct_from(T * memory, A && arguments, singularity_indices<I...>)
+    {
+        return new (memory) T(std::get<I>(std::forward<A>(arguments))...);
+    }
+
+    template <std::size_t I>
+    static inline typename singularity_slot<I, S...>::type * slot(char * block)
+    {
+        return reinterpret_cast<typename singularity_slot<I, S...>::type *>(block + singularity_slot<I, S...>::offset);
+    }
+
+    template <std::size_t ...I>
+    static inline references publish(char * block, singularity_indices<I...>)
+    {
+        int const published[] = {
+            (singularity_slot<I, S...>::singularity_type::adopt(slot<I>(block), true, &release<I>, &deallocate<I>), 0)...
+        };
+        (void)published;
+        return references(*slot<I>(block)...);
+    }
+
+    // The destroyer of instance I.
+    template <std::size_t I>
+    static void release(typename singularity_slot<I, S...>::type * instance)
+    {
+        typedef typename singularity_slot<I, S...>::type type;
+        instance->~type();
+        deallocate<I>(instance);
+    }
+
+    // The deallocator of instance I, which finds the block from the slot,
+    // and frees it once no other instance of the block lives.
+    template <std::size_t I>
+    static void deallocate(typename singularity_slot<I, S...>::type * instance)
+    {
+        char * block = reinterpret_cast<char *>(instance) - singularity_slot<I, S...>::offset;
+        singularity_block_header * header = reinterpret_cast<singularity_block_header *>(block);
+        if (header->live.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            header->~singularity_block_header();
+            ::operator delete(block);
+        }
+    }
+};
+
+} // detail namespace
+
+// Takes one tuple of constructor arguments for each singularity, such as
+// from std::make_tuple() or std::forward_as_tuple(), and returns the
+// instances.  Every group which shares a singularity with another must
+// list them in the same order, and the constructors must not use the
+// singularities of their own group, whose guards are held.
+template <class ...S, class ...P>
+inline std::tuple<typename detail::singularity_member<S>::type &...> create_all(P && ...arguments)
+{
+    static_assert(sizeof...(S) != 0, "create_all() requires at least one singularity");
+    static_assert(sizeof...(S) == sizeof...(P),
+        "create_all() requires one tuple of arguments for each singularity");
+
+    return detail::singularity_batch<S...>::create(std::forward<P>(arguments)...);
+}
+
+// Destroys the singularities in the reverse order, skipping those which
+// were already destroyed, and throws singularity_already_destroyed if
+// none was left.
+template <class ...S>
+inline void destroy_all()
+{
+    if (!detail::singularity_batch<S...>::destroy(typename detail::singularity_batch<S...>::indices()))
+    {
+        BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+    }
+}
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_BATCH_HPP
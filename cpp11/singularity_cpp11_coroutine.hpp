@@ -0,0 +1,108 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Lets a C++20 coroutine await the creation of a singularity.
+//!
+//! ::when_created() returns an awaitable, which is ready without taking
+//! the policy guard once the instance is accessible.  Otherwise it
+//! suspends the coroutine, instead of blocking its thread, until
+//! create_global() or create_global_async() publishes the instance, and
+//! resumes it through the executor chosen by the caller.  The coroutine
+//! must not be destroyed while it is suspended.
+//----------------------------------------------------------------------------
+//  typedef singularity<Routes, multi_threaded> routes;
+//
+//  task serve(io_context & io)
+//  {
+//      Routes & table = co_await routes::when_created(
+//          [&io](std::function<void ()> resume) { post(io, resume); });
+//  }
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_COROUTINE_HPP
+#define SINGULARITY_CPP11_COROUTINE_HPP
+
+#include <coroutine>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+#include <singularity_cpp11.hpp>
+
+namespace boost {
+
+namespace detail {
+
+// Lives in the frame of the coroutine while it is suspended, linked into
+// the waiters of type T.  The waiting count is incremented under their
+// mutex, and pairs with publish() as in get_global_wait_for().
+template <class T, class Executor> class singularity_awaiter : private singularity_continuation<T>
+{
+public:
+    inline singularity_awaiter(Executor executor, T* (*lookup)(), T* (*acquire)())
+      : executor(std::move(executor)), lookup(lookup), acquire(acquire)
+    {
+        this->next = 0;
+        this->instance = 0;
+    }
+
+    // Only a declared or an attached instance takes the guard, to be built
+    // or attached, before the coroutine is suspended.
+    inline bool await_ready()
+    {
+        this->instance = lookup();
+        if (this->instance == 0)
+        {
+            this->instance = acquire();
+        }
+        return this->instance != 0;
+    }
+
+    // Resumes at once, without the executor, when the instance was
+    // published since await_ready().
+    inline bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+        singularity_waiters<T> & waiters = singularity_waiters<T>::get();
+        std::lock_guard<std::mutex> lock(waiters.mutex);
+        singularity_instance<T>::state.waiting.fetch_add(1, std::memory_order_acq_rel);
+        this->instance = lookup();
+        if (this->instance != 0)
+        {
+            singularity_instance<T>::state.waiting.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        handle = coroutine;
+        this->next = waiters.suspended;
+        waiters.suspended = this;
+        return true;
+    }
+
+    inline T& await_resume() const
+    {
+        return *this->instance;
+    }
+private:
+    // The awaiter is gone as soon as the coroutine runs, so nothing of it
+    // is used once the executor was called.
+    virtual void resume()
+    {
+        Executor run(std::move(executor));
+        std::coroutine_handle<> const coroutine = handle;
+        run(std::function<void ()>([coroutine]() { coroutine.resume(); }));
+    }
+
+    Executor executor;
+    T* (*lookup)();
+    T* (*acquire)();
+    std::coroutine_handle<> handle;
+};
+
+} // detail namespace
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_COROUTINE_HPP
@@ -0,0 +1,321 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Measures what each singularity costs.
+//!
+//! The instrumented<M>::policy threading policy behaves like M, and also
+//! records the construction and destruction time of each instance, the
+//! time spent waiting for and holding the guard of M, and a sampled count
+//! of the calls to get_global().  The read guards of get_global() are only
+//! timed once in BOOST_SINGULARITY_STATS_SAMPLE_RATE acquisitions on each
+//! thread, and never when M has no real read guard.  The statistics of
+//! every instrumented type are kept by the singularity_stats_registry,
+//! which may also pass each event to a trace callback.  Singularities
+//! with other policies are not instrumented, and pay nothing.
+//----------------------------------------------------------------------------
+//  typedef singularity<Database, instrumented<multi_threaded>::policy> db;
+//
+//  db::create_global();
+//  singularity_stats const & stats = singularity_stats_of<Database>();
+//  singularity_stats_registry::for_each(print_stats);
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_INSTRUMENTATION_HPP
+#define SINGULARITY_CPP11_INSTRUMENTATION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+#include <typeinfo>
+
+#include <singularity_cpp11.hpp>
+#include <singularity_cpp11_policies.hpp>
+
+// get_global() only adds to the shared access count of a type, and times
+// the read guard, once in this many calls on each thread, so that the
+// instrumentation neither contends nor reads the clock on every call.
+#ifndef BOOST_SINGULARITY_STATS_SAMPLE_RATE
+#define BOOST_SINGULARITY_STATS_SAMPLE_RATE 64
+#endif
+
+namespace boost {
+
+// The statistics of one instrumented type.  Durations are in nanoseconds.
+// The access count, and the acquisitions of the read guard, are counted
+// in multiples of BOOST_SINGULARITY_STATS_SAMPLE_RATE, and the time spent
+// on the read guard is extrapolated from the acquisitions which were timed.
+struct singularity_stats
+{
+    constexpr singularity_stats()
+        : name(0), constructions(0), destructions(0), construction_time(0), destruction_time(0),
+          acquisitions(0), lock_wait_time(0), lock_hold_time(0), accesses(0), next(0) {}
+
+    char const * name;
+    std::atomic<unsigned long long> constructions;
+    std::atomic<unsigned long long> destructions;
+    std::atomic<unsigned long long> construction_time;
+    std::atomic<unsigned long long> destruction_time;
+    std::atomic<unsigned long long> acquisitions;
+    std::atomic<unsigned long long> lock_wait_time;
+    std::atomic<unsigned long long> lock_hold_time;
+    std::atomic<unsigned long long> accesses;
+    singularity_stats * next;
+};
+
+// The events which are passed to the trace callback, if one is set.
+struct singularity_event
+{
+    enum kind { constructed, destroyed, locked };
+
+    kind what;
+    char const * name;
+    // The construction or destruction time, or the time spent waiting
+    // for the guard, in nanoseconds.
+    unsigned long long duration;
+};
+
+typedef void (*singularity_trace)(singularity_event const &);
+
+// Lists the statistics of every type which was instrumented at least once.
+class singularity_stats_registry
+{
+public:
+    template <class F>
+    static inline void for_each(F visit)
+    {
+        for (singularity_stats * stats = head().load(std::memory_order_acquire); stats != 0; stats = stats->next)
+        {
+            visit(static_cast<singularity_stats const &>(*stats));
+        }
+    }
+
+    // The callback runs on the thread which caused the event, possibly
+    // under the guard of the policy, so it must not use the singularity.
+    // A null callback turns tracing off.
+    static inline void set_trace(singularity_trace trace)
+    {
+        callback().store(trace, std::memory_order_release);
+    }
+
+    static inline void enlist(singularity_stats & stats)
+    {
+        singularity_stats * first = head().load(std::memory_order_relaxed);
+        do
+        {
+            stats.next = first;
+        } while (!head().compare_exchange_weak(first, &stats, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    static inline void trace(singularity_event::kind what, char const * name, unsigned long long duration)
+    {
+        singularity_trace const trace = callback().load(std::memory_order_acquire);
+        if (trace != 0)
+        {
+            singularity_event const event = { what, name, duration };
+            trace(event);
+        }
+    }
+private:
+    static inline std::atomic<singularity_stats *> & head()
+    {
+        static std::atomic<singularity_stats *> first(0);
+        return first;
+    }
+
+    static inline std::atomic<singularity_trace> & callback()
+    {
+        static std::atomic<singularity_trace> trace(0);
+        return trace;
+    }
+};
+
+namespace detail {
+
+// The statistics of type T, which enlist themselves on first use.  They
+// are constant initialized, so they outlive any instance destroyed at exit.
+template <class T> struct singularity_stats_instance
+{
+    static inline singularity_stats & get()
+    {
+        static bool const enlisted = enlist();
+        (void)enlisted;
+        return stats;
+    }
+
+    static inline bool enlist()
+    {
+        stats.name = typeid(T).name();
+        singularity_stats_registry::enlist(stats);
+        return true;
+    }
+
+    static singularity_stats stats;
+};
+
+template <class T> singularity_stats singularity_stats_instance<T>::stats;
+
+inline unsigned long long singularity_elapsed(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Counts the acquisitions of the guards of type T on the calling thread,
+// and selects one in Rate of them to be recorded.
+template <class T, unsigned Rate> struct singularity_guard_sample
+{
+    static inline bool next()
+    {
+        static thread_local unsigned acquisitions = 0;
+        if (++acquisitions != Rate)
+        {
+            return false;
+        }
+        acquisitions = 0;
+        return true;
+    }
+};
+
+template <class T> struct singularity_guard_sample<T, 1>
+{
+    static inline bool next()
+    {
+        return true;
+    }
+};
+
+// A guard which has no state and does nothing when it is acquired or
+// released, such as the read_guard of lock_free_get, is not worth timing.
+template <class L> struct singularity_trivial_guard
+  : std::integral_constant<bool, std::is_empty<L>::value && std::is_trivially_destructible<L>::value> {};
+
+// Times a guard of the instrumented policy, from before it is acquired
+// until it is released, once in Rate acquisitions on each thread.  Each
+// sample stands for the Rate acquisitions it was taken from.
+template <class T, class L, unsigned Rate, bool = singularity_trivial_guard<L>::value> class singularity_timed_guard
+{
+public:
+    inline singularity_timed_guard()
+      : sampled(singularity_guard_sample<T, Rate>::next()), requested(stamp()), guard(), acquired(stamp())
+    {
+        if (sampled)
+        {
+            singularity_stats & stats = singularity_stats_instance<T>::get();
+            unsigned long long const waited =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(acquired - requested).count();
+            stats.acquisitions.fetch_add(Rate, std::memory_order_relaxed);
+            stats.lock_wait_time.fetch_add(waited * Rate, std::memory_order_relaxed);
+            singularity_stats_registry::trace(singularity_event::locked, stats.name, waited);
+        }
+    }
+    inline ~singularity_timed_guard()
+    {
+        if (sampled)
+        {
+            singularity_stats_instance<T>::get().lock_hold_time.fetch_add(singularity_elapsed(acquired) * Rate, std::memory_order_relaxed);
+        }
+    }
+    singularity_timed_guard(singularity_timed_guard const &) = delete;
+    singularity_timed_guard & operator=(singularity_timed_guard const &) = delete;
+private:
+    inline std::chrono::steady_clock::time_point stamp() const
+    {
+        return sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    }
+
+    bool const sampled;
+    std::chrono::steady_clock::time_point const requested;
+    L guard;
+    std::chrono::steady_clock::time_point const acquired;
+};
+
+// Only counts the acquisitions of a trivial guard.
+template <class T, class L, unsigned Rate> class singularity_timed_guard<T, L, Rate, true>
+{
+public:
+    inline singularity_timed_guard()
+    {
+        if (singularity_guard_sample<T, Rate>::next())
+        {
+            singularity_stats_instance<T>::get().acquisitions.fetch_add(Rate, std::memory_order_relaxed);
+        }
+    }
+    singularity_timed_guard(singularity_timed_guard const &) = delete;
+    singularity_timed_guard & operator=(singularity_timed_guard const &) = delete;
+private:
+    L guard;
+};
+
+} // detail namespace
+
+// Returns the statistics of T, which are all zero until it is instrumented.
+template <class T>
+inline singularity_stats const & singularity_stats_of()
+{
+    return detail::singularity_stats_instance<T>::get();
+}
+
+// Composes the instrumentation with the threading policy M, which keeps
+// its read_guard, grace_period and markers.  The guard of M, which is
+// taken by create() and destroy(), is timed whenever it is held, and the
+// read_guard of M is sampled.
+template <template <class> class M> struct instrumented
+{
+    template <class T> class policy
+    {
+    public:
+        typedef detail::singularity_timed_guard< T, typename detail::singularity_read_guard< M<T> >::type,
+                                                 BOOST_SINGULARITY_STATS_SAMPLE_RATE > read_guard;
+        typedef typename detail::singularity_grace_period< M<T> >::type grace_period;
+        typedef typename detail::singularity_thread_safe< M<T> >::type thread_safe;
+        typedef typename detail::singularity_readers_exclude_writers< M<T> >::type readers_exclude_writers;
+
+        struct instrumentation
+        {
+            typedef std::chrono::steady_clock::time_point stamp;
+
+            static inline stamp start()
+            {
+                return std::chrono::steady_clock::now();
+            }
+            static inline void constructed(stamp started)
+            {
+                singularity_stats & stats = detail::singularity_stats_instance<T>::get();
+                unsigned long long const duration = detail::singularity_elapsed(started);
+                stats.constructions.fetch_add(1, std::memory_order_relaxed);
+                stats.construction_time.fetch_add(duration, std::memory_order_relaxed);
+                singularity_stats_registry::trace(singularity_event::constructed, stats.name, duration);
+            }
+            static inline void destroyed(stamp started)
+            {
+                singularity_stats & stats = detail::singularity_stats_instance<T>::get();
+                unsigned long long const duration = detail::singularity_elapsed(started);
+                stats.destructions.fetch_add(1, std::memory_order_relaxed);
+                stats.destruction_time.fetch_add(duration, std::memory_order_relaxed);
+                singularity_stats_registry::trace(singularity_event::destroyed, stats.name, duration);
+            }
+            static inline void accessed()
+            {
+                static thread_local unsigned calls = 0;
+                if (++calls == BOOST_SINGULARITY_STATS_SAMPLE_RATE)
+                {
+                    calls = 0;
+                    detail::singularity_stats_instance<T>::get().accesses.fetch_add(
+                        BOOST_SINGULARITY_STATS_SAMPLE_RATE, std::memory_order_relaxed);
+                }
+            }
+        };
+    private:
+        detail::singularity_timed_guard< T, M<T>, 1 > guard;
+    };
+};
+
+// The instrumented counterpart of multi_threaded.
+template <class T> using instrumented_multi_threaded = instrumented<multi_threaded>::policy<T>;
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_INSTRUMENTATION_HPP
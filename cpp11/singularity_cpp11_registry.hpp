@@ -0,0 +1,318 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Creates and destroys many global singularities in dependency order.
+//!
+//! Each singularity is added to the registry together with the constructor
+//! arguments for create_global(), and the singularities it depends on.
+//! ::start() creates every singularity after those it depends on, running
+//! independent constructors in parallel, and ::shutdown() destroys them in
+//! the reverse order, again in parallel where no dependency forbids it.
+//----------------------------------------------------------------------------
+//  singularity_registry registry;
+//  registry.add< singularity<Config> >("service.conf");
+//  registry.add< singularity<Database, multi_threaded> >(std::ref(pool))
+//          .depends_on< singularity<Config> >();
+//  registry.start(8);
+//  ...
+//  registry.shutdown(8);
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_REGISTRY_HPP
+#define SINGULARITY_CPP11_REGISTRY_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <boost/throw_exception.hpp>
+
+#include <singularity_cpp11.hpp>
+
+namespace boost {
+
+// Thrown by add() when the singularity was already added, and by start()
+// when a dependency was never added, or the dependencies form a cycle.
+struct singularity_invalid_dependencies : virtual std::exception
+{
+    virtual char const *what() const throw()
+    {
+        return "boost::singularity_invalid_dependencies";
+    }
+};
+
+class singularity_registry
+{
+public:
+    // Records the singularities which one entry depends on.
+    class entry
+    {
+    public:
+        template <class ...D>
+        inline entry & depends_on()
+        {
+            std::type_index const added[] = { typeid(D)... };
+            dependencies.insert(dependencies.end(), added, added + sizeof...(D));
+            return *this;
+        }
+    private:
+        friend class singularity_registry;
+
+        std::function<void ()> create;
+        std::function<void ()> destroy;
+        std::vector<std::type_index> dependencies;
+        bool created;
+    };
+
+    singularity_registry() = default;
+    singularity_registry(singularity_registry const &) = delete;
+    singularity_registry & operator=(singularity_registry const &) = delete;
+
+    // The arguments are stored as by std::thread, so a reference must be
+    // wrapped in std::ref().  Each is passed to create_global() as an
+    // l-value, and the stored copies live as long as the registry.  The
+    // returned entry remains valid while the registry exists.  Each
+    // singularity can only be added once.
+    template <class Singularity, class ...A>
+    inline entry & add(A && ...args)
+    {
+        if (indices.count(typeid(Singularity)) != 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_invalid_dependencies());
+        }
+
+        std::shared_ptr< creator<Singularity, typename std::decay<A>::type...> > stored =
+            std::make_shared< creator<Singularity, typename std::decay<A>::type...> >(std::forward<A>(args)...);
+
+        entries.push_back(entry());
+        entry & added = entries.back();
+        added.create = [stored] { stored->create_global(); };
+        added.destroy = &Singularity::destroy;
+        added.created = false;
+        indices[typeid(Singularity)] = entries.size() - 1;
+        return added;
+    }
+
+    // Creates every singularity on up to the given number of threads.  If
+    // a constructor throws, the singularities which were already created
+    // are destroyed again, and the first exception is rethrown.
+    inline void start(unsigned threads = std::thread::hardware_concurrency())
+    {
+        std::vector< std::vector<std::size_t> > dependents(entries.size());
+        std::vector<std::size_t> blockers(entries.size(), 0);
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            for (std::type_index const & dependency : entries[i].dependencies)
+            {
+                std::map<std::type_index, std::size_t>::const_iterator found = indices.find(dependency);
+                if (found == indices.end())
+                {
+                    BOOST_THROW_EXCEPTION(singularity_invalid_dependencies());
+                }
+                dependents[found->second].push_back(i);
+                ++blockers[i];
+            }
+        }
+        verify_acyclic(dependents, blockers);
+
+        std::exception_ptr failure = run(dependents, blockers, threads, &start_entry);
+        if (failure)
+        {
+            shutdown(threads);
+            std::rethrow_exception(failure);
+        }
+    }
+
+    // Destroys every singularity created by start(), each one only after
+    // all of the singularities which depend on it.
+    inline void shutdown(unsigned threads = std::thread::hardware_concurrency())
+    {
+        std::vector< std::vector<std::size_t> > dependencies(entries.size());
+        std::vector<std::size_t> blockers(entries.size(), 0);
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            for (std::type_index const & dependency : entries[i].dependencies)
+            {
+                std::size_t const d = indices.find(dependency)->second;
+                dependencies[i].push_back(d);
+                ++blockers[d];
+            }
+        }
+
+        std::exception_ptr failure = run(dependencies, blockers, threads, &shutdown_entry);
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+    }
+private:
+    // Keeps the arguments of one entry.  It is shared, so the move only
+    // arguments of an entry can still be held by a std::function.
+    template <class Singularity, class ...A> class creator
+    {
+    public:
+        template <class ...U>
+        explicit creator(U && ...args) : arguments(std::forward<U>(args)...) {}
+        inline void create_global()
+        {
+            create_global(typename detail::singularity_make_indices<sizeof...(A)>::type());
+        }
+    private:
+        template <std::size_t ...I>
+        inline void create_global(detail::singularity_indices<I...>)
+        {
+            Singularity::create_global(std::get<I>(arguments)...);
+        }
+
+        std::tuple<A...> arguments;
+    };
+
+    static inline void start_entry(entry & e)
+    {
+        e.create();
+        e.created = true;
+    }
+
+    static inline void shutdown_entry(entry & e)
+    {
+        if (e.created)
+        {
+            e.created = false;
+            e.destroy();
+        }
+    }
+
+    // Kahn's algorithm on a copy of the counts, without running anything.
+    static inline void verify_acyclic(std::vector< std::vector<std::size_t> > const & successors,
+                                      std::vector<std::size_t> blockers)
+    {
+        std::vector<std::size_t> ready;
+        for (std::size_t i = 0; i < blockers.size(); ++i)
+        {
+            if (blockers[i] == 0)
+            {
+                ready.push_back(i);
+            }
+        }
+        std::size_t visited = 0;
+        while (!ready.empty())
+        {
+            std::size_t const i = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (std::size_t s : successors[i])
+            {
+                if (--blockers[s] == 0)
+                {
+                    ready.push_back(s);
+                }
+            }
+        }
+        if (visited != blockers.size())
+        {
+            BOOST_THROW_EXCEPTION(singularity_invalid_dependencies());
+        }
+    }
+
+    // Applies the action to every entry on a pool of threads.  An entry
+    // becomes ready once the actions of all entries blocking it finished.
+    // After the first failure, no new action starts, and the actions
+    // still running are waited for before the failure is returned.
+    inline std::exception_ptr run(std::vector< std::vector<std::size_t> > const & successors,
+                                  std::vector<std::size_t> & blockers,
+                                  unsigned threads, void (*action)(entry &))
+    {
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<std::size_t> ready;
+        std::size_t remaining = entries.size();
+        std::exception_ptr failure;
+
+        for (std::size_t i = 0; i < blockers.size(); ++i)
+        {
+            if (blockers[i] == 0)
+            {
+                ready.push_back(i);
+            }
+        }
+
+        std::function<void ()> work = [&]
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                wake.wait(lock, [&] { return !ready.empty() || remaining == 0 || failure; });
+                if (remaining == 0 || failure)
+                {
+                    return;
+                }
+                std::size_t const i = ready.back();
+                ready.pop_back();
+
+                lock.unlock();
+                std::exception_ptr thrown;
+                try
+                {
+                    action(entries[i]);
+                }
+                catch (...)
+                {
+                    thrown = std::current_exception();
+                }
+                lock.lock();
+
+                --remaining;
+                if (thrown && !failure)
+                {
+                    failure = thrown;
+                }
+                for (std::size_t s : successors[i])
+                {
+                    if (--blockers[s] == 0)
+                    {
+                        ready.push_back(s);
+                    }
+                }
+                wake.notify_all();
+            }
+        };
+
+        if (threads == 0)
+        {
+            threads = 1;
+        }
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads && t < entries.size(); ++t)
+        {
+            pool.push_back(std::thread(work));
+        }
+        work();
+        for (std::thread & thread : pool)
+        {
+            thread.join();
+        }
+        return failure;
+    }
+
+    std::deque<entry> entries;
+    std::map<std::type_index, std::size_t> indices;
+};
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_REGISTRY_HPP
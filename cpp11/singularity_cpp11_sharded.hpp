@@ -0,0 +1,498 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Enforces a single instance of a class in each shard of the program.
+//!
+//! A shard is a thread, a CPU or a NUMA node, as chosen by the shard policy.
+//! The lifetime of the instance of a shard is defined between ::create()
+//! and ::destroy(), both called from within that shard.  ::get_local()
+//! returns the instance of the calling shard without taking any lock, and
+//! ::for_each() visits the instances of all shards, to aggregate them.
+//!
+//! A replicated_singularity instead constructs one read-only instance with
+//! ::create_global(), and ::get_global() returns a copy of it local to the
+//! shard of the caller, so readers on every NUMA node access local memory.
+//----------------------------------------------------------------------------
+//  typedef sharded_singularity<Counter, thread_shard> counters;
+//
+//  counters::create();                          // on each worker thread
+//  ++counters::get_local().mValue;
+//  counters::for_each([&](Counter & c) { total += c.mValue; });
+//  counters::destroy();                         // on each worker thread
+//
+//  typedef replicated_singularity<Table, node_shard> tables;
+//
+//  tables::create_global("routes.dat");
+//  tables::get_global().lookup(key);            // on any thread
+//  tables::destroy();
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_SHARDED_HPP
+#define SINGULARITY_CPP11_SHARDED_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include <boost/throw_exception.hpp>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <singularity_cpp11.hpp>
+#include <singularity_cpp11_policies.hpp>
+
+// The user can choose a different number of shards for each type.  With
+// thread_shard, at most this many threads may hold a shard index at once.
+#ifndef BOOST_SINGULARITY_MAX_SHARDS
+#define BOOST_SINGULARITY_MAX_SHARDS 256
+#endif
+
+namespace boost {
+
+// Thrown by thread_shard when more threads than BOOST_SINGULARITY_MAX_SHARDS
+// need a shard index at the same time.
+struct singularity_shards_exhausted : virtual std::exception
+{
+    virtual char const *what() const throw()
+    {
+        return "boost::singularity_shards_exhausted";
+    }
+};
+
+namespace detail {
+
+// Hands out a free shard index to each thread, and takes it back once
+// the thread exited and the last instance in its shard was destroyed, so
+// a new thread never inherits the instances of one which exited.
+class singularity_thread_indices
+{
+public:
+    static inline std::size_t acquire()
+    {
+        singularity_thread_indices & indices = get();
+        std::lock_guard<std::mutex> lock(indices.mutex);
+        std::size_t index;
+        if (!indices.released.empty())
+        {
+            index = indices.released.back();
+            indices.released.pop_back();
+        }
+        else if (indices.next == BOOST_SINGULARITY_MAX_SHARDS)
+        {
+            BOOST_THROW_EXCEPTION(singularity_shards_exhausted());
+        }
+        else
+        {
+            index = indices.next++;
+        }
+        indices.exited[index] = false;
+        return index;
+    }
+    static inline void release(std::size_t index)
+    {
+        singularity_thread_indices & indices = get();
+        std::lock_guard<std::mutex> lock(indices.mutex);
+        indices.exited[index] = true;
+        if (indices.occupants[index] == 0)
+        {
+            indices.released.push_back(index);
+        }
+    }
+    static inline void occupy(std::size_t index)
+    {
+        singularity_thread_indices & indices = get();
+        std::lock_guard<std::mutex> lock(indices.mutex);
+        ++indices.occupants[index];
+    }
+    static inline void vacate(std::size_t index)
+    {
+        singularity_thread_indices & indices = get();
+        std::lock_guard<std::mutex> lock(indices.mutex);
+        if (--indices.occupants[index] == 0 && indices.exited[index])
+        {
+            indices.released.push_back(index);
+        }
+    }
+private:
+    singularity_thread_indices() : occupants(), exited(), next(0) {}
+
+    static inline singularity_thread_indices & get()
+    {
+        static singularity_thread_indices indices;
+        return indices;
+    }
+
+    std::mutex mutex;
+    std::vector<std::size_t> released;
+    unsigned occupants[BOOST_SINGULARITY_MAX_SHARDS];
+    bool exited[BOOST_SINGULARITY_MAX_SHARDS];
+    std::size_t next;
+};
+
+struct singularity_thread_index
+{
+    singularity_thread_index() : index(singularity_thread_indices::acquire()) {}
+    ~singularity_thread_index()
+    {
+        singularity_thread_indices::release(index);
+    }
+    std::size_t const index;
+};
+
+// The instances of every shard of type T, kept apart for each owning
+// class template O.  The slots are only written under the policy guard,
+// and read with an acquire load.
+template <class T, class O> struct singularity_shards
+{
+    static std::atomic<T *> slots[BOOST_SINGULARITY_MAX_SHARDS];
+    static void (*destroyer)(T *);
+};
+
+template <class T, class O> std::atomic<T *> singularity_shards<T, O>::slots[BOOST_SINGULARITY_MAX_SHARDS];
+template <class T, class O> void (*singularity_shards<T, O>::destroyer)(T *) = 0;
+
+// Destroys the instances of the shards which were never destroyed when
+// the program exits, unless singularity_leak_at_exit<T> is true.
+template <class T, class O> struct singularity_shard_reaper
+{
+    inline ~singularity_shard_reaper()
+    {
+        for (std::size_t i = 0; i < BOOST_SINGULARITY_MAX_SHARDS; ++i)
+        {
+            T * instance = singularity_shards<T, O>::slots[i].load(std::memory_order_relaxed);
+            if (instance != 0)
+            {
+                singularity_shards<T, O>::destroyer(instance);
+            }
+        }
+    }
+    static singularity_shard_reaper reaper;
+};
+
+template <class T, class O> singularity_shard_reaper<T, O> singularity_shard_reaper<T, O>::reaper;
+
+template <class T, class O, bool = singularity_leak_at_exit<T>::value> struct singularity_shard_exit
+{
+    static inline void enlist()
+    {
+        (void)&singularity_shard_reaper<T, O>::reaper;
+    }
+};
+
+template <class T, class O> struct singularity_shard_exit<T, O, true>
+{
+    static inline void enlist() {}
+};
+
+} // detail namespace
+
+// The shard policies map the calling thread to the index of its shard,
+// and are told when an instance is created in or destroyed from a shard.
+
+// Each thread is its own shard.  The instance of a thread which exits
+// without destroying it remains visible to for_each() and destroy_all().
+struct thread_shard
+{
+    static inline std::size_t index()
+    {
+        static thread_local detail::singularity_thread_index shard;
+        return shard.index;
+    }
+    static inline void occupy(std::size_t index)
+    {
+        detail::singularity_thread_indices::occupy(index);
+    }
+    static inline void vacate(std::size_t index)
+    {
+        detail::singularity_thread_indices::vacate(index);
+    }
+};
+
+// Each CPU is a shard.  A thread which migrates to another CPU moves to
+// the shard of that CPU, so create() and destroy() should be paired on
+// threads which are pinned.  The calling thread is always shard 0 where
+// the CPU cannot be queried.
+struct cpu_shard
+{
+    static inline std::size_t index()
+    {
+#if defined(__linux__)
+        int const cpu = sched_getcpu();
+        return cpu < 0 ? 0 : static_cast<std::size_t>(cpu) % BOOST_SINGULARITY_MAX_SHARDS;
+#else
+        return 0;
+#endif
+    }
+    static inline void occupy(std::size_t) {}
+    static inline void vacate(std::size_t) {}
+};
+
+// Each NUMA node is a shard, so threads on the same node share memory
+// which is local to them.  Falls back to shard 0 like cpu_shard.
+struct node_shard
+{
+    static inline std::size_t index()
+    {
+#if defined(__linux__) && defined(SYS_getcpu)
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, 0) != 0)
+        {
+            return 0;
+        }
+        return node % BOOST_SINGULARITY_MAX_SHARDS;
+#else
+        return 0;
+#endif
+    }
+    static inline void occupy(std::size_t) {}
+    static inline void vacate(std::size_t) {}
+};
+
+template <class T, class K = thread_shard, template <class> class M = multi_threaded>
+class sharded_singularity
+{
+public:
+    // Creates the instance of the calling shard.
+    template <class ...A>
+    static inline T& create(A && ...args)
+    {
+        std::size_t const index = K::index();
+        std::atomic<T *> & slot = shards::slots[index];
+
+        M<T> guard;
+        (void)guard;
+
+        if (slot.load(std::memory_order_relaxed) != 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_already_created());
+        }
+
+        detail::singularity_shard_exit<T, sharded_singularity>::enlist();
+        T * instance = new T(std::forward<A>(args)...);
+        K::occupy(index);
+        shards::destroyer = &release;
+        slot.store(instance, std::memory_order_release);
+        return *instance;
+    }
+
+    // Destroys the instance of the calling shard.
+    static inline void destroy()
+    {
+        std::size_t const index = K::index();
+        std::atomic<T *> & slot = shards::slots[index];
+
+        M<T> guard;
+        (void)guard;
+
+        T * instance = slot.load(std::memory_order_relaxed);
+        if (instance == 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+        }
+        slot.store(0, std::memory_order_release);
+        release(instance);
+        K::vacate(index);
+    }
+
+    // Destroys the instances of every shard.
+    static inline void destroy_all()
+    {
+        M<T> guard;
+        (void)guard;
+
+        for (std::size_t i = 0; i < BOOST_SINGULARITY_MAX_SHARDS; ++i)
+        {
+            T * instance = shards::slots[i].exchange(0, std::memory_order_acq_rel);
+            if (instance != 0)
+            {
+                release(instance);
+                K::vacate(i);
+            }
+        }
+    }
+
+    // Returns the instance of the calling shard with a single acquire
+    // load, which never contends with other shards.
+    static inline T& get_local()
+    {
+        T * instance = try_get_local();
+        if (instance == 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_not_created());
+        }
+        return *instance;
+    }
+
+    static inline T* try_get_local()
+    {
+        return shards::slots[K::index()].load(std::memory_order_acquire);
+    }
+
+    // Calls visit with the instance of every shard, under the policy
+    // guard, so no instance is created or destroyed meanwhile.  Do not
+    // call create() or destroy() from within visit.
+    template <class F>
+    static inline void for_each(F visit)
+    {
+        M<T> guard;
+        (void)guard;
+
+        for (std::size_t i = 0; i < BOOST_SINGULARITY_MAX_SHARDS; ++i)
+        {
+            T * instance = shards::slots[i].load(std::memory_order_acquire);
+            if (instance != 0)
+            {
+                visit(*instance);
+            }
+        }
+    }
+private:
+    typedef detail::singularity_shards<T, sharded_singularity> shards;
+
+    static inline void release(T * instance)
+    {
+        delete instance;
+    }
+};
+
+// Constructs T once, and gives each shard, by default each NUMA node, a
+// read-only copy of it.  The copy of a shard is made by the first call to
+// get_global() from that shard, on the calling thread, so the operating
+// system places its pages on the node which first touches them.  The
+// copies are never modified, so they always equal the original.
+template <class T, class K = node_shard, template <class> class M = multi_threaded>
+class replicated_singularity
+{
+public:
+    // Constructs the original, which becomes the replica of the calling shard.
+    template <class ...A>
+    static inline T const& create_global(A && ...args)
+    {
+        std::size_t const index = K::index();
+
+        M<T> guard;
+        (void)guard;
+
+        if (source != 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_already_created());
+        }
+
+        detail::singularity_shard_exit<T, replicated_singularity>::enlist();
+        T * instance = new T(std::forward<A>(args)...);
+        K::occupy(index);
+        shards::destroyer = &release;
+        source = instance;
+        shards::slots[index].store(instance, std::memory_order_release);
+        return *instance;
+    }
+
+    // Destroys the original and every replica.
+    static inline void destroy()
+    {
+        M<T> guard;
+        (void)guard;
+
+        if (source == 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+        }
+        source = 0;
+
+        for (std::size_t i = 0; i < BOOST_SINGULARITY_MAX_SHARDS; ++i)
+        {
+            T * instance = shards::slots[i].exchange(0, std::memory_order_acq_rel);
+            if (instance != 0)
+            {
+                release(instance);
+                K::vacate(i);
+            }
+        }
+    }
+
+    // Returns the replica of the calling shard.  After it was copied, this
+    // is a single acquire load of a pointer which is local to the shard.
+    static inline T const& get_global()
+    {
+        T const * instance = try_get_global();
+        if (instance == 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_not_created());
+        }
+        return *instance;
+    }
+
+    static inline T const* try_get_global()
+    {
+        std::size_t const index = K::index();
+        T const * instance = shards::slots[index].load(std::memory_order_acquire);
+        if (instance == 0)
+        {
+            instance = replicate(index);
+        }
+        return instance;
+    }
+
+    // Returns the number of shards which hold a replica.
+    static inline std::size_t replicas()
+    {
+        M<T> guard;
+        (void)guard;
+
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < BOOST_SINGULARITY_MAX_SHARDS; ++i)
+        {
+            if (shards::slots[i].load(std::memory_order_relaxed) != 0)
+            {
+                ++count;
+            }
+        }
+        return count;
+    }
+private:
+    typedef detail::singularity_shards<T, replicated_singularity> shards;
+
+    static inline T const* replicate(std::size_t index)
+    {
+        M<T> guard;
+        (void)guard;
+
+        // Another thread of the same shard may have copied it meanwhile.
+        T * instance = shards::slots[index].load(std::memory_order_relaxed);
+        if (instance == 0 && source != 0)
+        {
+            instance = new T(static_cast<T const &>(*source));
+            K::occupy(index);
+            shards::slots[index].store(instance, std::memory_order_release);
+        }
+        return instance;
+    }
+
+    static inline void release(T * instance)
+    {
+        delete instance;
+    }
+
+    static T * source;
+};
+
+template <class T, class K, template <class> class M> T * replicated_singularity<T, K, M>::source = 0;
+
+// Convenience macro which generates the required friend statements for
+// use inside classes which are created by the sharded singularities.
+#define FRIEND_CLASS_SHARDED_SINGULARITY \
+    template <class T, class K, template <class> class M> friend class sharded_singularity; \
+    template <class T, class K, template <class> class M> friend class replicated_singularity
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_SHARDED_HPP
@@ -0,0 +1,242 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Shares one instance of a class between processes.
+//!
+//! The shared_memory_storage policy constructs the instance in a named
+//! segment of shared memory.  Only one process can create the segment, so
+//! create_global() in any other process throws singularity_already_created.
+//! The other processes attach to the published instance with get_global(),
+//! without constructing it again, and detach from it with destroy().  The
+//! internals of T must allocate from the segment, through the allocator of
+//! the policy, whose pointers are offsets and so are valid in every process.
+//! A process forked after the instance was created only detaches from it
+//! as well, when it calls destroy() or exits.
+//----------------------------------------------------------------------------
+//  typedef shared_memory_storage<Table> storage;
+//  typedef singularity<Table, multi_threaded, shared_memory_storage> table;
+//
+//  Table::Table() : routes(storage::manager()) {}
+//
+//  storage::use("routes", 64 << 20);           // in every process
+//  table::create_global();                     // in the first process
+//  table::get_global();                        // in every other process
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_SHARED_MEMORY_HPP
+#define SINGULARITY_CPP11_SHARED_MEMORY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <boost/assert.hpp>
+#include <boost/interprocess/allocators/allocator.hpp>
+#include <boost/interprocess/managed_shared_memory.hpp>
+#include <boost/interprocess/shared_memory_object.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <unistd.h>
+
+#include <singularity_cpp11.hpp>
+
+namespace boost {
+
+namespace detail {
+
+// Is constructed in the segment, and records where the instance lives,
+// relative to itself, once it was published.  Zero while it is built.
+struct singularity_segment_record
+{
+    singularity_segment_record() : offset(0) {}
+    std::atomic<std::ptrdiff_t> offset;
+};
+
+} // detail namespace
+
+template <class T> class shared_memory_storage
+{
+public:
+    typedef ::boost::interprocess::managed_shared_memory segment_type;
+    typedef segment_type::segment_manager segment_manager;
+
+    // The allocator for the internals of T, such as the containers of
+    // Boost.Interprocess, which is constructed from manager().
+    template <class U> struct allocator
+    {
+        typedef ::boost::interprocess::allocator<U, segment_manager> type;
+    };
+
+    // Names the segment, and sets the size with which it is created.  Must
+    // be called in each process before the instance is created or looked up.
+    static inline void use(char const * name, std::size_t size)
+    {
+        segment_name = name;
+        segment_size = size;
+    }
+
+    // The manager of the segment of the calling process, while it is open,
+    // which includes the constructor of T.
+    static inline segment_manager * manager()
+    {
+        BOOST_ASSERT(segment != 0);
+        return segment->get_segment_manager();
+    }
+
+    // Creates the segment, which fails when any process created it first.
+    static inline void * allocate()
+    {
+        BOOST_ASSERT(segment_name != 0 && segment == 0);
+        try
+        {
+            segment = new segment_type(::boost::interprocess::create_only, segment_name, segment_size);
+            creator = ::getpid();
+        }
+        catch (::boost::interprocess::interprocess_exception const & e)
+        {
+            if (e.get_error_code() == ::boost::interprocess::already_exists_error)
+            {
+                BOOST_THROW_EXCEPTION(singularity_already_created());
+            }
+            throw;
+        }
+
+        try
+        {
+            record = segment->construct<detail::singularity_segment_record>(record_name)();
+            return segment->allocate_aligned(sizeof(T), detail::singularity_alignment<T>::value);
+        }
+        catch (...)
+        {
+            remove();
+            throw;
+        }
+    }
+
+    // Removes the segment, once the instance which created it is destroyed.
+    // Processes still attached keep their mapping until they detach, as
+    // does a child which inherited the segment from the creator.
+    static inline void deallocate(void * memory)
+    {
+        if (!owner())
+        {
+            close();
+            return;
+        }
+        segment->deallocate(memory);
+        remove();
+    }
+
+    // The hooks by which singularity finds an instance of another process.
+    struct attachment
+    {
+        // Is only asked once no instance was found in this process, and
+        // skips opening the segment when this process has it mapped, or
+        // when use() was never called.
+        static inline bool exists()
+        {
+            if (segment != 0)
+            {
+                return true;
+            }
+            if (segment_name == 0)
+            {
+                return false;
+            }
+            try
+            {
+                ::boost::interprocess::shared_memory_object(
+                    ::boost::interprocess::open_only, segment_name, ::boost::interprocess::read_only);
+                return true;
+            }
+            catch (::boost::interprocess::interprocess_exception const &)
+            {
+                return false;
+            }
+        }
+
+        // Maps the segment, and returns the instance once it was published.
+        static inline T* attach()
+        {
+            if (segment_name == 0 || segment != 0)
+            {
+                return 0;
+            }
+            try
+            {
+                segment = new segment_type(::boost::interprocess::open_only, segment_name);
+            }
+            catch (::boost::interprocess::interprocess_exception const &)
+            {
+                return 0;
+            }
+
+            record = segment->find<detail::singularity_segment_record>(record_name).first;
+            std::ptrdiff_t const offset = record == 0 ? 0 : record->offset.load(std::memory_order_acquire);
+            if (offset == 0)
+            {
+                close();
+                return 0;
+            }
+            return reinterpret_cast<T *>(reinterpret_cast<char *>(record) + offset);
+        }
+
+        // Unmaps the segment, leaving the instance to the process owning it.
+        static inline void detach(T *)
+        {
+            close();
+        }
+
+        // Only the process which created the instance destroys it.  Any
+        // other, including a child forked after it was created, detaches.
+        static inline bool owned(T *)
+        {
+            return owner();
+        }
+
+        static inline void published(T * instance)
+        {
+            record->offset.store(reinterpret_cast<char *>(instance) - reinterpret_cast<char *>(record),
+                                 std::memory_order_release);
+        }
+    };
+private:
+    static inline bool owner()
+    {
+        return segment != 0 && creator == ::getpid();
+    }
+
+    static inline void close()
+    {
+        delete segment;
+        segment = 0;
+        record = 0;
+    }
+
+    static inline void remove()
+    {
+        close();
+        ::boost::interprocess::shared_memory_object::remove(segment_name);
+    }
+
+    static char const * segment_name;
+    static std::size_t segment_size;
+    static segment_type * segment;
+    static pid_t creator;
+    static detail::singularity_segment_record * record;
+    static char const * const record_name;
+};
+
+template <class T> char const * shared_memory_storage<T>::segment_name = 0;
+template <class T> std::size_t shared_memory_storage<T>::segment_size = 0;
+template <class T> typename shared_memory_storage<T>::segment_type * shared_memory_storage<T>::segment = 0;
+template <class T> pid_t shared_memory_storage<T>::creator = 0;
+template <class T> detail::singularity_segment_record * shared_memory_storage<T>::record = 0;
+template <class T> char const * const shared_memory_storage<T>::record_name = "boost.singularity";
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_SHARED_MEMORY_HPP
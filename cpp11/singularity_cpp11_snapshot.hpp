@@ -0,0 +1,163 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+//! \file
+//! \brief Saves a singularity to an image file, and restores it by mapping.
+//!
+//! A type opts in by specializing singularity_snapshot, which asserts that
+//! its state is relocatable: it holds offsets instead of pointers, and is
+//! entirely contained in the size() bytes starting at the instance.  Then
+//! ::save_snapshot() writes the image of the global instance, and on a
+//! later start ::create_from_snapshot() maps the image and publishes it
+//! without constructing T, so its pages are only read when first touched.
+//----------------------------------------------------------------------------
+//  namespace boost {
+//  template <> struct singularity_snapshot<Table> : singularity_flat_snapshot<Table> {};
+//  }
+//
+//  if (exists(path)) table::create_from_snapshot(path);
+//  else { table::create_global(raw_data); table::save_snapshot(path); }
+//----------------------------------------------------------------------------
+
+#ifndef SINGULARITY_CPP11_SNAPSHOT_HPP
+#define SINGULARITY_CPP11_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <boost/throw_exception.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <singularity_cpp11.hpp>
+
+namespace boost {
+
+// Thrown when an image cannot be written, or cannot be mapped, or was
+// not written for this type.
+struct singularity_invalid_snapshot : virtual std::exception
+{
+    virtual char const *what() const throw()
+    {
+        return "boost::singularity_invalid_snapshot";
+    }
+};
+
+// Specialize to derive from std::true_type, with a static size(T const &)
+// returning the length of the image, for a type which is relocatable.
+template <class T> struct singularity_snapshot : std::false_type {};
+
+// The image of a type without any data outside of the object itself.
+template <class T> struct singularity_flat_snapshot : std::true_type
+{
+    static inline std::size_t size(T const &)
+    {
+        return sizeof(T);
+    }
+};
+
+namespace detail {
+
+// The image starts with this header, and the instance follows at offset
+// 64, which keeps it aligned within the page aligned mapping.
+struct singularity_image_header
+{
+    char magic[8];
+    std::uint64_t object_size;
+    std::uint64_t image_size;
+};
+
+static std::size_t const singularity_image_offset = 64;
+
+template <class T> struct singularity_image
+{
+    static_assert(singularity_snapshot<T>::value,
+        "the type must opt in through singularity_snapshot<T>");
+    static_assert(std::is_trivially_copyable<T>::value,
+        "only a trivially copyable type can be mapped from an image");
+    static_assert(std::alignment_of<T>::value <= singularity_image_offset,
+        "the image cannot align the type");
+
+    // Writes the image beside the path, and renames it into place, so a
+    // concurrent create_from_snapshot() never maps a partial image.
+    static inline void save(T const & instance, char const * path)
+    {
+        singularity_image_header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "SGLRTY01", sizeof(header.magic));
+        header.object_size = sizeof(T);
+        header.image_size = singularity_snapshot<T>::size(instance);
+
+        char padding[singularity_image_offset - sizeof(singularity_image_header)] = {};
+        std::string const partial = std::string(path) + ".partial";
+        std::FILE * file = std::fopen(partial.c_str(), "wb");
+        if (file == 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_invalid_snapshot());
+        }
+        bool const written =
+            std::fwrite(&header, sizeof(header), 1, file) == 1
+            && std::fwrite(padding, sizeof(padding), 1, file) == 1
+            && std::fwrite(&instance, header.image_size, 1, file) == 1;
+        if (std::fclose(file) != 0 || !written || std::rename(partial.c_str(), path) != 0)
+        {
+            std::remove(partial.c_str());
+            BOOST_THROW_EXCEPTION(singularity_invalid_snapshot());
+        }
+    }
+
+    // Maps the image privately, so the instance may still be modified
+    // without writing to the file.
+    static inline T* map(char const * path)
+    {
+        int const descriptor = ::open(path, O_RDONLY);
+        if (descriptor < 0)
+        {
+            BOOST_THROW_EXCEPTION(singularity_invalid_snapshot());
+        }
+        struct stat status;
+        void * mapping = MAP_FAILED;
+        if (::fstat(descriptor, &status) == 0
+            && static_cast<std::size_t>(status.st_size) >= singularity_image_offset + sizeof(T))
+        {
+            mapping = ::mmap(0, status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+        }
+        ::close(descriptor);
+        if (mapping == MAP_FAILED)
+        {
+            BOOST_THROW_EXCEPTION(singularity_invalid_snapshot());
+        }
+
+        singularity_image_header const * header = static_cast<singularity_image_header const *>(mapping);
+        if (std::memcmp(header->magic, "SGLRTY01", sizeof(header->magic)) != 0
+            || header->object_size != sizeof(T)
+            || header->image_size + singularity_image_offset != static_cast<std::uint64_t>(status.st_size))
+        {
+            ::munmap(mapping, status.st_size);
+            BOOST_THROW_EXCEPTION(singularity_invalid_snapshot());
+        }
+        return reinterpret_cast<T *>(static_cast<char *>(mapping) + singularity_image_offset);
+    }
+
+    // Unmaps the image, in place of destroying the instance.
+    static inline void unmap(T * instance)
+    {
+        char * mapping = reinterpret_cast<char *>(instance) - singularity_image_offset;
+        ::munmap(mapping, reinterpret_cast<singularity_image_header *>(mapping)->image_size + singularity_image_offset);
+    }
+};
+
+} // detail namespace
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_SNAPSHOT_HPP
@@ -0,0 +1,208 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SINGULARITY_CPP11_STORAGE_HPP
+#define SINGULARITY_CPP11_STORAGE_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <boost/assert.hpp>
+#include <type_traits>
+
+namespace boost {
+
+// The storage model for Singularity is also policy based.  A storage
+// policy supplies raw memory for the instance with allocate(), and
+// takes it back with deallocate() after the instance is destroyed.
+// Singularity constructs and destroys the instance in place.
+
+namespace detail {
+
+// The storage policies align the instance to its own alignment, and to
+// at least four bytes, which leaves the two low bits of its address to
+// the compact state.
+template <class T> struct singularity_alignment
+{
+    static std::size_t const value = std::alignment_of<T>::value < 4 ? 4 : std::alignment_of<T>::value;
+};
+
+// Selects the aligned operator new of C++17 for a type which is aligned
+// beyond what the plain one guarantees.  Before C++17, the free store
+// cannot align such a type, so it is rejected.
+template <class T> struct singularity_over_aligned
+#if defined(__cpp_aligned_new)
+  : std::integral_constant<bool, (singularity_alignment<T>::value > __STDCPP_DEFAULT_NEW_ALIGNMENT__)> {};
+#else
+  : std::false_type
+{
+    static_assert(singularity_alignment<T>::value <= std::alignment_of<std::max_align_t>::value,
+        "heap_storage cannot align the type before C++17");
+};
+#endif
+
+} // detail namespace
+
+// The heap_storage policy obtains the instance from the free store,
+// which is the default behavior, at the alignment of T, as a
+// new-expression would.
+template <class T> class heap_storage
+{
+public:
+    static inline void * allocate()
+    {
+        return allocate(typename detail::singularity_over_aligned<T>::type());
+    }
+    static inline void deallocate(void * memory)
+    {
+        deallocate(memory, typename detail::singularity_over_aligned<T>::type());
+    }
+private:
+    static inline void * allocate(std::false_type)
+    {
+        return ::operator new(sizeof(T));
+    }
+    static inline void deallocate(void * memory, std::false_type)
+    {
+        ::operator delete(memory);
+    }
+#if defined(__cpp_aligned_new)
+    static inline void * allocate(std::true_type)
+    {
+        return ::operator new(sizeof(T), std::align_val_t(detail::singularity_alignment<T>::value));
+    }
+    static inline void deallocate(void * memory, std::true_type)
+    {
+        ::operator delete(memory, std::align_val_t(detail::singularity_alignment<T>::value));
+    }
+#endif
+};
+
+// The static_storage policy constructs the instance in aligned storage
+// reserved for type T in the data segment, so create() never touches
+// the heap, and no allocator needs to exist when it is called.
+template <class T> class static_storage
+{
+public:
+    static inline void * allocate()
+    {
+        return &storage;
+    }
+    static inline void deallocate(void *) {}
+private:
+    static typename std::aligned_storage<sizeof(T), detail::singularity_alignment<T>::value>::type storage;
+};
+
+template <class T> typename std::aligned_storage<sizeof(T), detail::singularity_alignment<T>::value>::type static_storage<T>::storage;
+
+// Selects the std-style allocator which allocator_storage uses for type
+// T.  Specialize it to place T with a custom allocator, which is rebound
+// to T if required.
+template <class T> struct singularity_allocator
+{
+    typedef std::allocator<T> type;
+};
+
+// The allocator_storage policy obtains the instance from the allocator
+// selected by singularity_allocator<T>.
+template <class T> class allocator_storage
+{
+public:
+    static inline void * allocate()
+    {
+        return std::allocator_traits<allocator_type>::allocate(allocator, 1);
+    }
+    static inline void deallocate(void * memory)
+    {
+        std::allocator_traits<allocator_type>::deallocate(allocator, static_cast<T *>(memory), 1);
+    }
+private:
+    typedef typename std::allocator_traits<typename singularity_allocator<T>::type>::template rebind_alloc<T> allocator_type;
+    static allocator_type allocator;
+};
+
+template <class T> typename allocator_storage<T>::allocator_type allocator_storage<T>::allocator;
+
+// The interface of a user supplied arena, such as a pool of huge pages,
+// or memory bound to a particular NUMA node.
+class singularity_arena
+{
+public:
+    virtual void * allocate(std::size_t size, std::size_t alignment) = 0;
+    virtual void deallocate(void * memory, std::size_t size, std::size_t alignment) = 0;
+protected:
+    ~singularity_arena() {}
+};
+
+// The arena_storage policy obtains the instance from the arena passed to
+// use(), which must be called before the instance is created.  The
+// memory is always returned to the arena it came from, which is kept in
+// a header in front of the instance, even after use() selected another.
+template <class T> class arena_storage
+{
+public:
+    static inline void use(singularity_arena & arena)
+    {
+        selected = &arena;
+    }
+    static inline void * allocate()
+    {
+        BOOST_ASSERT(selected != 0);
+        char * block = static_cast<char *>(selected->allocate(size, alignment));
+        new (block) singularity_arena *(selected);
+        return block + offset;
+    }
+    static inline void deallocate(void * memory)
+    {
+        char * block = static_cast<char *>(memory) - offset;
+        singularity_arena * const owner = *reinterpret_cast<singularity_arena **>(block);
+        owner->deallocate(block, size, alignment);
+    }
+private:
+    static std::size_t const alignment =
+        detail::singularity_alignment<T>::value < std::alignment_of<singularity_arena *>::value
+            ? std::alignment_of<singularity_arena *>::value : detail::singularity_alignment<T>::value;
+    static std::size_t const offset =
+        (sizeof(singularity_arena *) + detail::singularity_alignment<T>::value - 1)
+            / detail::singularity_alignment<T>::value * detail::singularity_alignment<T>::value;
+    static std::size_t const size = offset + sizeof(T);
+
+    static singularity_arena * selected;
+};
+
+template <class T> singularity_arena * arena_storage<T>::selected = 0;
+
+namespace detail {
+
+// Returns the memory to the storage policy if the constructor of T
+// throws, and is released once the instance has been constructed.
+template <class S> class singularity_storage_guard
+{
+public:
+    inline singularity_storage_guard() : memory(S::allocate()) {}
+    inline ~singularity_storage_guard()
+    {
+        if (memory != 0)
+        {
+            S::deallocate(memory);
+        }
+    }
+    inline void * get() const
+    {
+        return memory;
+    }
+    inline void release()
+    {
+        memory = 0;
+    }
+private:
+    void * memory;
+};
+
+} // detail namespace
+
+} // boost namespace
+
+#endif // SINGULARITY_CPP11_STORAGE_HPP
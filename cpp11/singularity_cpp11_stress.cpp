@@ -0,0 +1,320 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+// Races create_global(), get_global() and destroy() of the C++11
+// singularity from many threads, for every thread safe policy, and checks
+// that no two instances are ever alive at once, and that readers never
+// see a destroyed instance.  Prints the throughput and latency percentiles
+// of each scenario, and exits with a failure status if a check failed.
+//
+//  g++ -std=c++11 -O2 -I. -Icpp11 cpp11/singularity_cpp11_stress.cpp -lboost_thread -pthread
+//  ./a.out [threads] [iterations] > results.csv
+//
+// Compile with -fsanitize=thread -g, and run fewer iterations, to also
+// detect data races.  Readers dereference the instance through a
+// global_reader, whose read guard keeps destroy() from running, except
+// with lock_free_get and compact_multi_threaded, which leave the lifetime
+// of the instance to their callers, so their readers only look it up.
+//----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <singularity_cpp11.hpp>
+
+namespace {
+
+using ::boost::singularity;
+using ::boost::multi_threaded;
+using ::boost::lock_free_get;
+using ::boost::shared_multi_threaded;
+using ::boost::spinlock_multi_threaded;
+using ::boost::adaptive_multi_threaded;
+using ::boost::rcu_multi_threaded;
+using ::boost::compact_multi_threaded;
+using ::boost::singularity_already_destroyed;
+using ::boost::singularity_not_created;
+
+typedef std::chrono::steady_clock clock_type;
+
+template <template <class> class M> struct policy_name;
+template <> struct policy_name<multi_threaded>          { static char const * get() { return "multi_threaded"; } };
+template <> struct policy_name<lock_free_get>           { static char const * get() { return "lock_free_get"; } };
+template <> struct policy_name<shared_multi_threaded>   { static char const * get() { return "shared_multi_threaded"; } };
+template <> struct policy_name<spinlock_multi_threaded> { static char const * get() { return "spinlock_multi_threaded"; } };
+template <> struct policy_name<adaptive_multi_threaded> { static char const * get() { return "adaptive_multi_threaded"; } };
+template <> struct policy_name<rcu_multi_threaded>      { static char const * get() { return "rcu_multi_threaded"; } };
+template <> struct policy_name<compact_multi_threaded>  { static char const * get() { return "compact_multi_threaded"; } };
+
+// Whether the read guard of the policy keeps the instance alive.
+template <template <class> class M> struct guarded_reads : std::true_type {};
+template <> struct guarded_reads<lock_free_get> : std::false_type {};
+template <> struct guarded_reads<compact_multi_threaded> : std::false_type {};
+
+std::atomic<bool> failed(false);
+
+void fail(char const * policy, char const * scenario, char const * what)
+{
+    failed.store(true);
+    std::fprintf(stderr, "FAILED,%s,%s,%s\n", policy, scenario, what);
+}
+
+// One distinct singularity type for each policy, which counts its live
+// instances, and clears its value when destroyed.
+template <template <class> class M> class Payload
+{
+public:
+    Payload() : mValue(1)
+    {
+        if (sLive.fetch_add(1) != 0)
+        {
+            sOverlapped.store(true);
+        }
+    }
+    ~Payload()
+    {
+        mValue = 0;
+        sLive.fetch_sub(1);
+    }
+    int mValue;
+    static std::atomic<int> sLive;
+    static std::atomic<bool> sOverlapped;
+};
+
+template <template <class> class M> std::atomic<int> Payload<M>::sLive(0);
+template <template <class> class M> std::atomic<bool> Payload<M>::sOverlapped(false);
+
+} // namespace anonymous
+
+namespace boost {
+template <> struct singularity_compact_state< Payload<compact_multi_threaded> > : std::true_type {};
+} // boost namespace
+
+namespace {
+
+// Releases all the threads of a scenario at the same instant.
+class start_gate
+{
+public:
+    start_gate() : mWaiting(0), mOpen(false) {}
+    void wait()
+    {
+        mWaiting.fetch_add(1);
+        while (!mOpen.load(std::memory_order_acquire)) {}
+    }
+    void open(unsigned threads)
+    {
+        while (mWaiting.load() != threads) {}
+        mOpen.store(true, std::memory_order_release);
+    }
+private:
+    std::atomic<unsigned> mWaiting;
+    std::atomic<bool> mOpen;
+};
+
+// A getter only runs while the instance lives, so it may call get_global().
+enum role { creator, destroyer, reader, getter };
+
+template <template <class> class M>
+bool read_once(char const * scenario, std::true_type)
+{
+    typedef singularity<Payload<M>, M> singularity_type;
+    try
+    {
+        typename singularity_type::global_reader instance;
+        if (instance->mValue != 1)
+        {
+            fail(policy_name<M>::get(), scenario, "read a destroyed instance");
+        }
+        return true;
+    }
+    catch (singularity_not_created const &)
+    {
+        return false;
+    }
+}
+
+template <template <class> class M>
+bool read_once(char const *, std::false_type)
+{
+    return singularity<Payload<M>, M>::try_get_global() != 0;
+}
+
+template <template <class> class M>
+void perform(role what, char const * scenario)
+{
+    typedef singularity<Payload<M>, M> singularity_type;
+    switch (what)
+    {
+    case creator:
+        singularity_type::try_create_global();
+        break;
+    case destroyer:
+        try
+        {
+            singularity_type::destroy();
+        }
+        catch (singularity_already_destroyed const &)
+        {
+        }
+        break;
+    case reader:
+        read_once<M>(scenario, guarded_reads<M>());
+        break;
+    case getter:
+        if (singularity_type::get_global().mValue != 1)
+        {
+            fail(policy_name<M>::get(), scenario, "read a destroyed instance");
+        }
+        break;
+    }
+}
+
+// Creators and destroyers alternate, so that each also finds the
+// instance in the state the other leaves it in.
+template <template <class> class M>
+void work(role first, char const * scenario, start_gate & gate, unsigned long iterations,
+          std::vector<unsigned long long> & latencies)
+{
+    latencies.reserve(iterations);
+    gate.wait();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        role what = first;
+        if ((i & 1) != 0 && (first == creator || first == destroyer))
+        {
+            what = first == creator ? destroyer : creator;
+        }
+        clock_type::time_point const start = clock_type::now();
+        perform<M>(what, scenario);
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+    }
+}
+
+void print_header()
+{
+    std::printf("header,policy,scenario,threads,operations,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+}
+
+template <template <class> class M>
+void report(char const * scenario, unsigned threads, clock_type::duration elapsed,
+            std::vector< std::vector<unsigned long long> > const & latencies)
+{
+    std::vector<unsigned long long> all;
+    for (unsigned t = 0; t < latencies.size(); ++t)
+    {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+    }
+    if (all.empty())
+    {
+        return;
+    }
+    std::sort(all.begin(), all.end());
+    double const seconds = std::chrono::duration<double>(elapsed).count();
+    std::size_t const last = all.size() - 1;
+    std::printf("cpp11,%s,%s,%u,%lu,%.0f,%llu,%llu,%llu,%llu\n", policy_name<M>::get(), scenario, threads,
+        static_cast<unsigned long>(all.size()), all.size() / seconds,
+        all[last * 50 / 100], all[last * 99 / 100], all[last * 999 / 1000], all[last]);
+}
+
+// Runs one scenario, in which thread t takes the role roles(t).
+template <template <class> class M>
+void stress(char const * scenario, role (*roles)(unsigned), unsigned threads, unsigned long iterations)
+{
+    typedef singularity<Payload<M>, M> singularity_type;
+
+    start_gate gate;
+    std::vector< std::vector<unsigned long long> > latencies(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.push_back(std::thread(&work<M>, roles(t), scenario,
+            std::ref(gate), iterations, std::ref(latencies[t])));
+    }
+
+    clock_type::time_point const start = clock_type::now();
+    gate.open(threads);
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers[t].join();
+    }
+    clock_type::duration const elapsed = clock_type::now() - start;
+
+    if (singularity_type::try_get_global() != 0)
+    {
+        singularity_type::destroy();
+    }
+    if (Payload<M>::sOverlapped.exchange(false))
+    {
+        fail(policy_name<M>::get(), scenario, "two instances were alive at once");
+    }
+    if (Payload<M>::sLive.load() != 0)
+    {
+        fail(policy_name<M>::get(), scenario, "an instance was leaked");
+    }
+    report<M>(scenario, threads, elapsed, latencies);
+}
+
+role every_getter(unsigned)
+{
+    return getter;
+}
+
+role half_creators(unsigned t)
+{
+    return (t & 1) == 0 ? creator : destroyer;
+}
+
+role mixed_roles(unsigned t)
+{
+    return t % 4 == 0 ? creator : (t % 4 == 1 ? destroyer : reader);
+}
+
+template <template <class> class M>
+void stress_policy(unsigned threads, unsigned long iterations)
+{
+    typedef singularity<Payload<M>, M> singularity_type;
+
+    singularity_type::create_global();
+    stress<M>("get_global", &every_getter, threads, iterations);
+    stress<M>("create_destroy", &half_creators, std::max(threads, 2u), iterations / 10);
+    stress<M>("mixed", &mixed_roles, std::max(threads, 4u), iterations / 10);
+}
+
+} // namespace anonymous
+
+int main(int argc, char * argv[])
+{
+    unsigned threads = std::thread::hardware_concurrency();
+    unsigned long iterations = 100000;
+    if (argc > 1)
+    {
+        threads = static_cast<unsigned>(std::strtoul(argv[1], 0, 10));
+    }
+    if (argc > 2)
+    {
+        iterations = std::strtoul(argv[2], 0, 10);
+    }
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+
+    print_header();
+    stress_policy<multi_threaded>(threads, iterations);
+    stress_policy<lock_free_get>(threads, iterations);
+    stress_policy<shared_multi_threaded>(threads, iterations);
+    stress_policy<spinlock_multi_threaded>(threads, iterations);
+    stress_policy<adaptive_multi_threaded>(threads, iterations);
+    stress_policy<rcu_multi_threaded>(threads, iterations);
+    stress_policy<compact_multi_threaded>(threads, iterations);
+    return failed.load() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -5,15 +5,60 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 //#define BOOST_TEST_MAIN defined
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 #include <boost/test/unit_test.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/interprocess/containers/vector.hpp>
 #include <singularity_cpp11.hpp>
+#include <singularity_cpp11_registry.hpp>
+#include <singularity_cpp11_sharded.hpp>
+#include <singularity_cpp11_instrumentation.hpp>
+#include <singularity_cpp11_shared_memory.hpp>
+#include <singularity_cpp11_snapshot.hpp>
+#include <singularity_cpp11_batch.hpp>
+#if defined(__cpp_impl_coroutine)
+#include <singularity_cpp11_coroutine.hpp>
+#endif
 
 namespace {
 
 using ::boost::singularity;
 using ::boost::single_threaded;
 using ::boost::multi_threaded;
+using ::boost::lock_free_get;
+using ::boost::shared_multi_threaded;
+using ::boost::spinlock_multi_threaded;
+using ::boost::adaptive_multi_threaded;
+using ::boost::rcu_multi_threaded;
+using ::boost::compact_multi_threaded;
+using ::boost::static_storage;
+using ::boost::heap_storage;
+using ::boost::global_access;
+using ::boost::allocator_storage;
+using ::boost::arena_storage;
+using ::boost::singularity_arena;
+using ::boost::singularity_registry;
+using ::boost::sharded_singularity;
+using ::boost::thread_shard;
+using ::boost::replicated_singularity;
+using ::boost::instrumented;
+using ::boost::singularity_stats;
+using ::boost::singularity_stats_of;
+using ::boost::singularity_stats_registry;
+using ::boost::singularity_event;
+using ::boost::shared_memory_storage;
 using ::boost::noncopyable;
 
 // Some generic, non POD class.
@@ -24,6 +69,228 @@ public:
     int mValue;
 };
 
+// A read-only table which counts the copies made of it.
+class Table {
+public:
+    explicit Table(int size) : mEntries(size, 7) {}
+    Table(Table const & other) : mEntries(other.mEntries) { ++sCopies; }
+    std::vector<int> mEntries;
+    static std::atomic<int> sCopies;
+};
+
+std::atomic<int> Table::sCopies(0);
+
+// Is measured by the instrumented policy.
+class Probe : private noncopyable {
+public:
+    explicit Probe(int value) : mValue(value) {}
+    int mValue;
+};
+
+#if defined(__cpp_aligned_new)
+// Is aligned beyond what the plain operator new guarantees.
+class alignas(256) Wide : private noncopyable {
+public:
+    Wide() : mValue(1) {}
+    int mValue;
+};
+#endif
+
+// Is only used by the test of a sampled read guard.
+class Sampled : private noncopyable {
+public:
+    explicit Sampled(int value) : mValue(value) {}
+    int mValue;
+};
+
+// Lives in shared memory, with internals allocated from the same segment.
+class Shared : private noncopyable {
+public:
+    typedef boost::interprocess::vector<int, shared_memory_storage<Shared>::allocator<int>::type> values_type;
+    explicit Shared(int count) : mValues(count, 9, shared_memory_storage<Shared>::manager()), mHits(0) {}
+    values_type mValues;
+    std::atomic<int> mHits;
+};
+
+// Is never given a segment with use().
+class Unnamed : private noncopyable {
+public:
+    Unnamed() {}
+};
+
+// Counts the events passed to the trace callback.
+std::atomic<int> sTraced(0);
+
+void countEvent(singularity_event const & event) {
+    if (event.what == singularity_event::constructed) {
+        ++sTraced;
+    }
+}
+
+// Counts its constructions, and accepts an argument which can only be moved.
+class Parcel : private noncopyable {
+public:
+    explicit Parcel(std::unique_ptr<int> xValue) : mValue(std::move(xValue)) { ++sConstructions; }
+    std::unique_ptr<int> mValue;
+    static std::atomic<int> sConstructions;
+};
+
+std::atomic<int> Parcel::sConstructions(0);
+
+// Records when it was created and destroyed, on a clock shared by all services.
+template <int N> class Service : private noncopyable {
+public:
+    explicit Service(std::atomic<int> & xClock) : mClock(xClock), mCreated(xClock++) {}
+    ~Service() { sDestroyed = mClock++; }
+    std::atomic<int> & mClock;
+    int mCreated;
+    static int sDestroyed;
+};
+
+template <int N> int Service<N>::sDestroyed = -1;
+
+// Blocks its constructor until the test opens it.
+class Gated : private noncopyable {
+public:
+    explicit Gated(int xInt) : mInt(xInt) {
+        while (!sOpen.load()) {
+            std::this_thread::yield();
+        }
+    }
+    int mInt;
+    static std::atomic<bool> sOpen;
+};
+
+std::atomic<bool> Gated::sOpen(false);
+
+// Counts the instances which are alive, to observe deferred destruction.
+class Versioned : private noncopyable {
+public:
+    explicit Versioned(int xVersion) : mVersion(xVersion) { ++sLive; }
+    ~Versioned() { --sLive; }
+    int mVersion;
+    static std::atomic<int> sLive;
+};
+
+std::atomic<int> Versioned::sLive(0);
+
+// Fails to construct from a negative version, and counts its live instances.
+class Fragile : private noncopyable {
+public:
+    explicit Fragile(int xVersion) : mVersion(xVersion) {
+        if (xVersion < 0) {
+            throw std::runtime_error("Fragile");
+        }
+        ++sLive;
+    }
+    ~Fragile() { --sLive; }
+    int mVersion;
+    static std::atomic<int> sLive;
+};
+
+std::atomic<int> Fragile::sLive(0);
+
+// Fails to construct, so the services created before it are destroyed again.
+class Faulty : private noncopyable {
+public:
+    Faulty() { throw std::runtime_error("Faulty"); }
+};
+
+// Refuses to be constructed as many times as the test asks.
+class Reluctant : private noncopyable {
+public:
+    explicit Reluctant(int xInt) : mInt(xInt) {
+        if (sRefusals > 0) {
+            --sRefusals;
+            throw std::runtime_error("Reluctant");
+        }
+    }
+    // Takes ownership of its argument before it refuses.
+    explicit Reluctant(std::unique_ptr<int> xInt) : Reluctant(*xInt) {}
+    int mInt;
+    static int sRefusals;
+};
+
+int Reluctant::sRefusals = 0;
+
+// An arena which counts the memory it hands out.
+class CountingArena : public singularity_arena {
+public:
+    CountingArena() : mAllocations(0), mDeallocations(0) {}
+    virtual void * allocate(std::size_t size, std::size_t) {
+        ++mAllocations;
+        return ::operator new(size);
+    }
+    virtual void deallocate(void * memory, std::size_t, std::size_t) {
+        ++mDeallocations;
+        ::operator delete(memory);
+    }
+    int mAllocations;
+    int mDeallocations;
+};
+
+// Counts its destructions, and is left to the operating system at exit.
+class Leaked : private noncopyable {
+public:
+    ~Leaked() { ++sDestroyed; }
+    static int sDestroyed;
+};
+
+int Leaked::sDestroyed = 0;
+
+// Counts events on the thread which owns it.
+class Tally : private noncopyable {
+public:
+    explicit Tally(int value) : mValue(value) {}
+    int mValue;
+};
+
+// A relocatable table, which may be restored from a snapshot.
+struct Lookup {
+    explicit Lookup(int seed) {
+        for (int i = 0; i < 1024; ++i) {
+            mValues[i] = seed * i;
+        }
+    }
+    int mValues[1024];
+};
+
+// Keeps its state in a single word, and is only byte aligned.
+class Flag : private noncopyable {
+public:
+    explicit Flag(char xValue) : mValue(xValue) {}
+    char mValue;
+};
+
+#if defined(__cpp_impl_coroutine)
+// Awaited by a coroutine, which runs to completion without being awaited.
+class Beacon : private noncopyable {
+public:
+    explicit Beacon(int xInt) : mInt(xInt) {}
+    int mInt;
+};
+
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return Detached(); }
+        std::suspend_never initial_suspend() { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+#endif
+
+} // namespace anonymous
+
+namespace boost {
+template <> struct singularity_leak_at_exit<Leaked> : std::integral_constant<bool, true> {};
+template <> struct singularity_snapshot<Lookup> : singularity_flat_snapshot<Lookup> {};
+template <> struct singularity_compact_state<Flag> : std::integral_constant<bool, true> {};
+} // boost namespace
+
+namespace {
+
 // This class demonstrates making itself a Singularity,
 // by making its constructors private, and friending
 // the Singularity.
@@ -206,4 +473,897 @@ BOOST_AUTO_TEST_CASE(demonstrateGlobalMultiThreadedUsage) {
     singularityType::destroy();
 }
 
+BOOST_AUTO_TEST_CASE(demonstrateLockFreeGetUsage) {
+    typedef singularity<Horizon, lock_free_get> singularityType;
+
+    Horizon & horizon = singularityType::create_global();
+    Horizon & SameHorizon = singularityType::get_global();
+    BOOST_CHECK_EQUAL(&horizon, &SameHorizon);
+
+    singularityType::destroy();
+    BOOST_CHECK_THROW(
+        Horizon & noHorizon = singularityType::get_global(),
+        boost::singularity_not_created
+    );
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateSharedMultiThreadedUsage) {
+    typedef singularity<Horizon, shared_multi_threaded> singularityType;
+
+    Horizon & horizon = singularityType::create_global(14);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    {
+        singularityType::global_reader reader;
+        BOOST_CHECK_EQUAL(reader->mInt, 14);
+        BOOST_CHECK_EQUAL(&*reader, &horizon);
+    }
+    singularityType::destroy();
+
+    BOOST_CHECK_THROW(
+        singularityType::global_reader reader,
+        boost::singularity_not_created
+    );
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateStaticStorageUsage) {
+    typedef singularity<Horizon, single_threaded, static_storage> singularityType;
+
+    Horizon & horizon = singularityType::create(12);
+    BOOST_CHECK_EQUAL(horizon.mInt, 12);
+    singularityType::destroy();
+
+    Horizon & sameStorage = singularityType::create_global(13);
+    BOOST_CHECK_EQUAL(&horizon, &sameStorage);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mInt, 13);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateCompileTimeGlobalAccess) {
+    typedef singularity<Horizon, lock_free_get, heap_storage, global_access> singularityType;
+
+    BOOST_CHECK_THROW(
+        Horizon & noHorizon = singularityType::get_global(),
+        boost::singularity_not_created
+    );
+
+    Horizon & horizon = singularityType::create_global(15);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(tryCreateShouldReturnNullIfAlreadyCreated) {
+    Horizon * horizon = singularity<Horizon>::try_create(16);
+    BOOST_REQUIRE(horizon != 0);
+    BOOST_CHECK_EQUAL(horizon->mInt, 16);
+    BOOST_CHECK(singularity<Horizon>::try_create() == 0);
+    BOOST_CHECK(singularity<Horizon>::try_create_global() == 0);
+    singularity<Horizon>::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(tryGetGlobalShouldReturnNullIfNotAccessible) {
+    BOOST_CHECK(singularity<Horizon>::try_get_global() == 0);
+
+    Horizon & horizon = singularity<Horizon>::create();
+    BOOST_CHECK(singularity<Horizon>::try_get_global() == 0);
+    singularity<Horizon>::destroy();
+
+    Horizon & globalHorizon = singularity<Horizon>::create_global();
+    BOOST_CHECK_EQUAL(singularity<Horizon>::try_get_global(), &globalHorizon);
+    BOOST_CHECK_EQUAL(&singularity<Horizon>::get_global_unchecked(), &globalHorizon);
+    singularity<Horizon>::destroy();
+
+    BOOST_CHECK(singularity<Horizon>::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateAllocatorStorageUsage) {
+    typedef singularity<Horizon, single_threaded, allocator_storage> singularityType;
+
+    Horizon & horizon = singularityType::create(17);
+    BOOST_CHECK_EQUAL(horizon.mInt, 17);
+    singularityType::destroy();
+}
+
+#if defined(__cpp_aligned_new)
+BOOST_AUTO_TEST_CASE(heapStorageShouldAlignAnOverAlignedType) {
+    typedef singularity<Wide> singularityType;
+
+    for (int i = 0; i < 8; ++i) {
+        Wide & wide = singularityType::create();
+        BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(&wide) % alignof(Wide), 0u);
+        BOOST_CHECK_EQUAL(wide.mValue, 1);
+        singularityType::destroy();
+    }
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(arenaStorageShouldReturnEachInstanceToItsArena) {
+    typedef singularity<Horizon, rcu_multi_threaded, arena_storage> singularityType;
+
+    CountingArena first;
+    CountingArena second;
+    arena_storage<Horizon>::use(first);
+    singularityType::create_global(19);
+
+    arena_storage<Horizon>::use(second);
+    Horizon & replacement = singularityType::replace(20);
+    BOOST_CHECK_EQUAL(replacement.mInt, 20);
+    BOOST_CHECK_EQUAL(first.mAllocations, 1);
+    BOOST_CHECK_EQUAL(first.mDeallocations, 1);
+    BOOST_CHECK_EQUAL(second.mAllocations, 1);
+    BOOST_CHECK_EQUAL(second.mDeallocations, 0);
+
+    arena_storage<Horizon>::use(first);
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(first.mDeallocations, 1);
+    BOOST_CHECK_EQUAL(second.mDeallocations, 1);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateArenaStorageUsage) {
+    typedef singularity<Horizon, multi_threaded, arena_storage> singularityType;
+
+    CountingArena arena;
+    arena_storage<Horizon>::use(arena);
+
+    Horizon & horizon = singularityType::create(18);
+    BOOST_CHECK_EQUAL(horizon.mInt, 18);
+    BOOST_CHECK_EQUAL(arena.mAllocations, 1);
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 0);
+
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 1);
+}
+
+BOOST_AUTO_TEST_CASE(getGlobalCachedShouldDetectRecreationAndDestruction) {
+    typedef singularity<Horizon, lock_free_get, static_storage> singularityType;
+
+    BOOST_CHECK_THROW(
+        singularityType::get_global_cached(),
+        boost::singularity_no_global_access
+    );
+
+    singularityType::create_global(19);
+    BOOST_CHECK_EQUAL(singularityType::get_global_cached().mInt, 19);
+    BOOST_CHECK_EQUAL(singularityType::get_global_cached().mInt, 19);
+    singularityType::destroy();
+
+    BOOST_CHECK_THROW(
+        singularityType::get_global_cached(),
+        boost::singularity_not_created
+    );
+
+    // The storage is reused, so only the generation tells them apart.
+    singularityType::create(20);
+    BOOST_CHECK_THROW(
+        singularityType::get_global_cached(),
+        boost::singularity_no_global_access
+    );
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateSpinlockMultiThreadedUsage) {
+    typedef singularity<Horizon, spinlock_multi_threaded> singularityType;
+
+    Horizon & horizon = singularityType::create_global(21);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    BOOST_CHECK_THROW(singularityType::create(22), boost::singularity_already_created);
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateAdaptiveMultiThreadedUsage) {
+    typedef singularity<Horizon, adaptive_multi_threaded> singularityType;
+
+    Horizon & horizon = singularityType::create_global(23);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    BOOST_CHECK_THROW(singularityType::create(24), boost::singularity_already_created);
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(declareGlobalShouldBuildOnFirstGetGlobal) {
+    typedef singularity<Horizon, shared_multi_threaded> singularityType;
+
+    Event event(25);
+    singularityType::declare_global(std::ref(event));
+    BOOST_CHECK_THROW(singularityType::create(26), boost::singularity_already_created);
+    BOOST_CHECK_THROW(singularityType::declare_global(26), boost::singularity_already_created);
+
+    Horizon & horizon = singularityType::get_global();
+    BOOST_CHECK_EQUAL(&horizon.mEventRef, &event);
+    BOOST_CHECK_EQUAL(singularityType::try_get_global(), &horizon);
+    singularityType::destroy();
+
+    // A declaration which was never built is discarded by destroy().
+    singularityType::declare_global(27);
+    singularityType::destroy();
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(declareGlobalShouldSurviveAThrowingConstructor) {
+    typedef singularity<Reluctant, multi_threaded> singularityType;
+
+    Reluctant::sRefusals = 1;
+    singularityType::declare_global(29);
+    BOOST_CHECK_THROW(singularityType::get_global(), std::runtime_error);
+    BOOST_CHECK_THROW(singularityType::declare_global(30), boost::singularity_already_created);
+
+    BOOST_CHECK_EQUAL(singularityType::get_global().mInt, 29);
+    singularityType::destroy();
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(declareGlobalShouldKeepTheFailureOfAMovedArgument) {
+    typedef singularity<Reluctant, multi_threaded> singularityType;
+
+    Reluctant::sRefusals = 1;
+    singularityType::declare_global(std::unique_ptr<int>(new int(31)));
+    BOOST_CHECK_THROW(singularityType::get_global(), std::runtime_error);
+    BOOST_CHECK_THROW(singularityType::get_global(), std::runtime_error);
+    BOOST_CHECK_THROW(singularityType::declare_global(std::unique_ptr<int>(new int(32))), boost::singularity_already_created);
+
+    singularityType::destroy();
+    singularityType::declare_global(std::unique_ptr<int>(new int(32)));
+    BOOST_CHECK_EQUAL(singularityType::get_global().mInt, 32);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(declareGlobalShouldBuildOnceWhenFirstCallersRace) {
+    typedef singularity<Parcel, lock_free_get> singularityType;
+
+    singularityType::declare_global(std::unique_ptr<int>(new int(28)));
+    BOOST_CHECK_EQUAL(Parcel::sConstructions.load(), 0);
+
+    Parcel * instances[4];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.push_back(std::thread([&instances, i] { instances[i] = &singularityType::get_global(); }));
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+
+    BOOST_CHECK_EQUAL(Parcel::sConstructions.load(), 1);
+    for (int i = 1; i < 4; ++i) {
+        BOOST_CHECK_EQUAL(instances[i], instances[0]);
+    }
+    BOOST_CHECK_EQUAL(*instances[0]->mValue, 28);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(createOrGetGlobalShouldConstructOnceWhenCallersRace) {
+    typedef singularity<Parcel, multi_threaded> singularityType;
+
+    int const constructions = Parcel::sConstructions.load();
+    Parcel * instances[4];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.push_back(std::thread([&instances, i] {
+            instances[i] = &singularityType::create_or_get_global(std::unique_ptr<int>(new int(i)));
+        }));
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+
+    BOOST_CHECK_EQUAL(Parcel::sConstructions.load(), constructions + 1);
+    for (int i = 1; i < 4; ++i) {
+        BOOST_CHECK_EQUAL(instances[i], instances[0]);
+    }
+    BOOST_CHECK_EQUAL(&singularityType::create_or_get_global(std::unique_ptr<int>()), instances[0]);
+    BOOST_CHECK_EQUAL(Parcel::sConstructions.load(), constructions + 1);
+    singularityType::destroy();
+
+    singularityType::create(std::unique_ptr<int>());
+    BOOST_CHECK_THROW(singularityType::create_or_get_global(std::unique_ptr<int>()), boost::singularity_no_global_access);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(registryShouldCreateAndDestroyInDependencyOrder) {
+    typedef singularity<Service<0>, multi_threaded> configType;
+    typedef singularity<Service<1>, multi_threaded> databaseType;
+    typedef singularity<Service<2>, multi_threaded> cacheType;
+    typedef singularity<Service<3>, multi_threaded> frontendType;
+
+    std::atomic<int> clock(0);
+    singularity_registry registry;
+    registry.add<frontendType>(std::ref(clock)).depends_on<databaseType, cacheType>();
+    registry.add<databaseType>(std::ref(clock)).depends_on<configType>();
+    registry.add<cacheType>(std::ref(clock)).depends_on<configType>();
+    registry.add<configType>(std::ref(clock));
+    registry.start(4);
+
+    BOOST_CHECK_LT(configType::get_global().mCreated, databaseType::get_global().mCreated);
+    BOOST_CHECK_LT(configType::get_global().mCreated, cacheType::get_global().mCreated);
+    BOOST_CHECK_LT(databaseType::get_global().mCreated, frontendType::get_global().mCreated);
+    BOOST_CHECK_LT(cacheType::get_global().mCreated, frontendType::get_global().mCreated);
+
+    registry.shutdown(4);
+    BOOST_CHECK(configType::try_get_global() == 0);
+    BOOST_CHECK(frontendType::try_get_global() == 0);
+    BOOST_CHECK_LT(Service<3>::sDestroyed, Service<1>::sDestroyed);
+    BOOST_CHECK_LT(Service<3>::sDestroyed, Service<2>::sDestroyed);
+    BOOST_CHECK_LT(Service<1>::sDestroyed, Service<0>::sDestroyed);
+    BOOST_CHECK_LT(Service<2>::sDestroyed, Service<0>::sDestroyed);
+}
+
+BOOST_AUTO_TEST_CASE(registryShouldRejectInvalidDependencies) {
+    typedef singularity<Service<4>, multi_threaded> firstType;
+    typedef singularity<Service<5>, multi_threaded> secondType;
+
+    std::atomic<int> clock(0);
+    singularity_registry unknown;
+    unknown.add<firstType>(std::ref(clock)).depends_on<secondType>();
+    BOOST_CHECK_THROW(unknown.start(), boost::singularity_invalid_dependencies);
+
+    singularity_registry cycle;
+    cycle.add<firstType>(std::ref(clock)).depends_on<secondType>();
+    cycle.add<secondType>(std::ref(clock)).depends_on<firstType>();
+    BOOST_CHECK_THROW(cycle.start(), boost::singularity_invalid_dependencies);
+    BOOST_CHECK(firstType::try_get_global() == 0);
+
+    singularity_registry twice;
+    twice.add<firstType>(std::ref(clock));
+    BOOST_CHECK_THROW(twice.add<firstType>(std::ref(clock)), boost::singularity_invalid_dependencies);
+    twice.start();
+    BOOST_CHECK(firstType::try_get_global() != 0);
+    twice.shutdown();
+    BOOST_CHECK(firstType::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(registryShouldUndoStartWhenAConstructorThrows) {
+    typedef singularity<Service<6>, multi_threaded> serviceType;
+    typedef singularity<Faulty, multi_threaded> faultyType;
+
+    std::atomic<int> clock(0);
+    singularity_registry registry;
+    registry.add<serviceType>(std::ref(clock));
+    registry.add<faultyType>().depends_on<serviceType>();
+    BOOST_CHECK_THROW(registry.start(2), std::runtime_error);
+    BOOST_CHECK(serviceType::try_get_global() == 0);
+    BOOST_CHECK(faultyType::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(createAllShouldPlaceTheGroupInOneBlock) {
+    typedef singularity<Service<7>, multi_threaded> configType;
+    typedef singularity<Service<8>, multi_threaded> databaseType;
+    typedef singularity<Flag, compact_multi_threaded> flagType;
+
+    std::atomic<int> clock(0);
+    std::tuple<Service<7> &, Service<8> &, Flag &> group =
+        boost::create_all<configType, databaseType, flagType>(
+            std::forward_as_tuple(clock), std::forward_as_tuple(clock), std::make_tuple('f'));
+    BOOST_CHECK_EQUAL(&configType::get_global(), &std::get<0>(group));
+    BOOST_CHECK_EQUAL(&flagType::get_global(), &std::get<2>(group));
+    BOOST_CHECK_EQUAL(flagType::get_global().mValue, 'f');
+    char const * first = reinterpret_cast<char const *>(&std::get<0>(group));
+    char const * last = reinterpret_cast<char const *>(&std::get<2>(group));
+    BOOST_CHECK_GT(last, first);
+    BOOST_CHECK_LT(last - first, static_cast<std::ptrdiff_t>(2 * sizeof(Service<7>) + 64));
+    BOOST_CHECK_THROW((boost::create_all<configType, flagType>(
+        std::forward_as_tuple(clock), std::make_tuple('g'))), boost::singularity_already_created);
+
+    // An instance of the group may still be destroyed on its own.
+    flagType::destroy();
+    boost::destroy_all<configType, databaseType, flagType>();
+    BOOST_CHECK(configType::try_get_global() == 0);
+    BOOST_CHECK(databaseType::try_get_global() == 0);
+    BOOST_CHECK_LT(Service<8>::sDestroyed, Service<7>::sDestroyed);
+    BOOST_CHECK_THROW((boost::destroy_all<configType, databaseType>()), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(createAllShouldPublishNothingWhenAConstructorThrows) {
+    typedef singularity<Service<7>, multi_threaded> configType;
+    typedef singularity<Faulty, multi_threaded> faultyType;
+
+    std::atomic<int> clock(0);
+    Service<7>::sDestroyed = -1;
+    BOOST_CHECK_THROW((boost::create_all<configType, faultyType>(
+        std::forward_as_tuple(clock), std::make_tuple())), std::runtime_error);
+    BOOST_CHECK(configType::try_get_global() == 0);
+    BOOST_CHECK(faultyType::try_get_global() == 0);
+    BOOST_CHECK_EQUAL(Service<7>::sDestroyed, 1);
+}
+
+BOOST_AUTO_TEST_CASE(recreateShouldNotDestroyABatchMemberTwice) {
+    typedef singularity<Fragile, multi_threaded> fragileType;
+    typedef singularity<Service<7>, multi_threaded> configType;
+
+    std::atomic<int> clock(0);
+    boost::create_all<fragileType, configType>(std::make_tuple(1), std::forward_as_tuple(clock));
+    BOOST_CHECK_EQUAL(fragileType::recreate(2).mVersion, 2);
+    BOOST_CHECK_THROW(fragileType::recreate(-1), std::runtime_error);
+    BOOST_CHECK_EQUAL(Fragile::sLive.load(), 0);
+    BOOST_CHECK(fragileType::try_get_global() == 0);
+    BOOST_CHECK(configType::try_get_global() != 0);
+
+    boost::destroy_all<fragileType, configType>();
+    BOOST_CHECK(configType::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(createGlobalAsyncShouldPublishWhenConstructed) {
+    typedef singularity<Gated, multi_threaded> singularityType;
+
+    Gated::sOpen = false;
+    std::shared_future<Gated &> future = singularityType::create_global_async(29);
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+    BOOST_CHECK(singularityType::get_global_wait_for(std::chrono::milliseconds(1)) == 0);
+    BOOST_CHECK(singularityType::try_get_global_for(std::chrono::milliseconds(1)) == 0);
+    BOOST_CHECK_THROW(singularityType::create(30), boost::singularity_already_created);
+    BOOST_CHECK_THROW(singularityType::get_global(), boost::singularity_not_created);
+
+    Gated::sOpen = true;
+    Gated * instance = singularityType::try_get_global_for(std::chrono::seconds(10));
+    BOOST_CHECK_EQUAL(instance, &future.get());
+    BOOST_CHECK_EQUAL(singularityType::get_global_wait_for(std::chrono::seconds(10)), instance);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mInt, 29);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(createOrGetGlobalShouldWaitForCreateGlobalAsync) {
+    typedef singularity<Gated, multi_threaded> singularityType;
+
+    Gated::sOpen = false;
+    std::shared_future<Gated &> future = singularityType::create_global_async(33);
+    std::thread opener([] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        Gated::sOpen = true;
+    });
+
+    Gated & found = singularityType::create_or_get_global(34);
+    opener.join();
+    BOOST_CHECK_EQUAL(&found, &future.get());
+    BOOST_CHECK_EQUAL(found.mInt, 33);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(destroyShouldAbandonCreateGlobalAsync) {
+    typedef singularity<Gated, multi_threaded> singularityType;
+
+    Gated::sOpen = false;
+    std::shared_future<Gated &> future = singularityType::create_global_async(31);
+    singularityType::destroy();
+
+    Gated::sOpen = true;
+    BOOST_CHECK_THROW(future.get(), boost::singularity_not_created);
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(getGlobalWaitShouldWakeWhenCreated) {
+    typedef singularity<Horizon, multi_threaded> singularityType;
+
+    BOOST_CHECK(singularityType::get_global_wait_for(std::chrono::milliseconds(1)) == 0);
+
+    Horizon * waited = 0;
+    Horizon * waitedFor = 0;
+    std::thread waiter([&waited] { waited = &singularityType::get_global_wait(); });
+    std::thread timedWaiter([&waitedFor] { waitedFor = singularityType::get_global_wait_for(std::chrono::seconds(10)); });
+
+    // Both waiters must be blocked before the instance is published.
+    while (::boost::detail::singularity_instance<Horizon>::state.waiting.load() != 2) {
+        std::this_thread::yield();
+    }
+    Horizon & horizon = singularityType::create_global(32);
+    waiter.join();
+    timedWaiter.join();
+    BOOST_CHECK_EQUAL(waited, &horizon);
+    BOOST_CHECK_EQUAL(waitedFor, &horizon);
+    BOOST_CHECK_EQUAL(singularityType::get_global_wait().mInt, 32);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(replaceShouldPublishANewInstance) {
+    typedef singularity<Horizon, rcu_multi_threaded> singularityType;
+
+    BOOST_CHECK_THROW(singularityType::replace(33), boost::singularity_not_created);
+
+    singularityType::create_global(33);
+    Horizon & replacement = singularityType::replace(34);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &replacement);
+    {
+        singularityType::global_reader reader;
+        BOOST_CHECK_EQUAL(reader->mInt, 34);
+    }
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::replace(35), boost::singularity_not_created);
+}
+
+BOOST_AUTO_TEST_CASE(replaceShouldWaitForReadersOfTheOldInstance) {
+    typedef singularity<Versioned, rcu_multi_threaded> singularityType;
+
+    singularityType::create_global(1);
+    std::atomic<bool> replaced(false);
+    std::thread writer;
+    {
+        singularityType::global_reader reader;
+        writer = std::thread([&replaced] { singularityType::replace(2); replaced = true; });
+        while (Versioned::sLive.load() != 2) {
+            std::this_thread::yield();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        BOOST_CHECK(!replaced.load());
+        BOOST_CHECK_EQUAL(reader->mVersion, 1);
+    }
+    writer.join();
+    BOOST_CHECK(replaced.load());
+    BOOST_CHECK_EQUAL(Versioned::sLive.load(), 1);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mVersion, 2);
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(Versioned::sLive.load(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(destroyAsyncShouldUnpublishBeforeReclaiming) {
+    typedef singularity<Versioned, multi_threaded> singularityType;
+
+    std::vector< std::function<void ()> > tasks;
+    std::function<void (std::function<void ()>)> executor =
+        [&tasks](std::function<void ()> task) { tasks.push_back(task); };
+
+    singularityType::create_global(3);
+    std::future<void> reclaimed = singularityType::destroy_async(executor);
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+    BOOST_CHECK_EQUAL(Versioned::sLive.load(), 1);
+    BOOST_CHECK_THROW(singularityType::destroy_async(executor), boost::singularity_already_destroyed);
+
+    // A new instance may be created while the old one awaits reclamation.
+    singularityType::create_global(4);
+    BOOST_CHECK_EQUAL(Versioned::sLive.load(), 2);
+    BOOST_CHECK_EQUAL(tasks.size(), 1u);
+    tasks[0]();
+    BOOST_CHECK(reclaimed.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    BOOST_CHECK_EQUAL(Versioned::sLive.load(), 1);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mVersion, 4);
+
+    singularityType::destroy_async().wait();
+    BOOST_CHECK_EQUAL(Versioned::sLive.load(), 0);
+}
+
+#if defined(__cpp_impl_coroutine)
+typedef singularity<Beacon, multi_threaded> beaconType;
+typedef std::function<void (std::function<void ()>)> executorType;
+
+Detached awaitBeacon(executorType executor, int & seen) {
+    Beacon & beacon = co_await beaconType::when_created(executor);
+    seen = beacon.mInt;
+}
+
+BOOST_AUTO_TEST_CASE(whenCreatedShouldResumeOnTheExecutor) {
+    std::vector< std::function<void ()> > tasks;
+    executorType executor = [&tasks](std::function<void ()> task) { tasks.push_back(task); };
+
+    int seen = 0;
+    awaitBeacon(executor, seen);
+    BOOST_CHECK_EQUAL(seen, 0);
+
+    // Only an instance with global access resumes the coroutine.
+    beaconType::create(1);
+    BOOST_CHECK(tasks.empty());
+    beaconType::destroy();
+
+    beaconType::create_global(2);
+    BOOST_CHECK_EQUAL(tasks.size(), 1u);
+    BOOST_CHECK_EQUAL(seen, 0);
+    tasks[0]();
+    BOOST_CHECK_EQUAL(seen, 2);
+
+    // Once the instance exists, the coroutine is not suspended.
+    seen = 0;
+    awaitBeacon(executor, seen);
+    BOOST_CHECK_EQUAL(seen, 2);
+    BOOST_CHECK_EQUAL(tasks.size(), 1u);
+    beaconType::destroy();
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(leakAtExitShouldStillDestroyExplicitly) {
+    typedef singularity<Leaked, multi_threaded> singularityType;
+
+    singularityType::create();
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(Leaked::sDestroyed, 1);
+
+    // This instance is deliberately never destroyed.
+    singularityType::create_global();
+    BOOST_CHECK_EQUAL(Leaked::sDestroyed, 1);
+}
+
+BOOST_AUTO_TEST_CASE(shardedSingularityShouldKeepOneInstancePerThread) {
+    typedef sharded_singularity<Tally, thread_shard> shardedType;
+
+    BOOST_CHECK(shardedType::try_get_local() == 0);
+    BOOST_CHECK_THROW(shardedType::get_local(), boost::singularity_not_created);
+    BOOST_CHECK_THROW(shardedType::destroy(), boost::singularity_already_destroyed);
+
+    shardedType::create(1);
+    BOOST_CHECK_THROW(shardedType::create(1), boost::singularity_already_created);
+
+    std::vector<std::thread> threads;
+    for (int i = 2; i <= 4; ++i) {
+        threads.push_back(std::thread([i] {
+            BOOST_CHECK(shardedType::try_get_local() == 0);
+            shardedType::create(0);
+            shardedType::get_local().mValue += i;
+        }));
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(shardedType::get_local().mValue, 1);
+
+    int total = 0;
+    int shards = 0;
+    shardedType::for_each([&](Tally & tally) { total += tally.mValue; ++shards; });
+    BOOST_CHECK_EQUAL(total, 10);
+    BOOST_CHECK_EQUAL(shards, 4);
+
+    shardedType::destroy();
+    BOOST_CHECK(shardedType::try_get_local() == 0);
+    shardedType::destroy_all();
+    shards = 0;
+    shardedType::for_each([&](Tally &) { ++shards; });
+    BOOST_CHECK_EQUAL(shards, 0);
+}
+
+BOOST_AUTO_TEST_CASE(replicatedSingularityShouldCopyOncePerShard) {
+    typedef replicated_singularity<Table, thread_shard> replicatedType;
+
+    BOOST_CHECK(replicatedType::try_get_global() == 0);
+    BOOST_CHECK_THROW(replicatedType::get_global(), boost::singularity_not_created);
+
+    Table const & original = replicatedType::create_global(16);
+    BOOST_CHECK_THROW(replicatedType::create_global(16), boost::singularity_already_created);
+    BOOST_CHECK_EQUAL(&replicatedType::get_global(), &original);
+    BOOST_CHECK_EQUAL(Table::sCopies.load(), 0);
+
+    std::vector<Table const *> replicas(3);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < replicas.size(); ++i) {
+        threads.push_back(std::thread([i, &replicas] {
+            replicas[i] = &replicatedType::get_global();
+            BOOST_CHECK_EQUAL(&replicatedType::get_global(), replicas[i]);
+            BOOST_CHECK_EQUAL(replicas[i]->mEntries.size(), 16u);
+        }));
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(Table::sCopies.load(), 3);
+    BOOST_CHECK_EQUAL(replicatedType::replicas(), 4u);
+    BOOST_CHECK(replicas[0] != &original && replicas[0] != replicas[1] && replicas[1] != replicas[2]);
+
+    replicatedType::destroy();
+    BOOST_CHECK_EQUAL(replicatedType::replicas(), 0u);
+    BOOST_CHECK(replicatedType::try_get_global() == 0);
+    BOOST_CHECK_THROW(replicatedType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(instrumentedPolicyShouldForwardTheMarkers) {
+    using ::boost::detail::singularity_readers_exclude_writers;
+    using ::boost::detail::singularity_thread_safe;
+
+    static_assert(singularity_readers_exclude_writers< instrumented<multi_threaded>::policy<Probe> >::value,
+        "the readers of multi_threaded hold the guard");
+    static_assert(!singularity_readers_exclude_writers< instrumented<rcu_multi_threaded>::policy<Probe> >::value,
+        "the readers of rcu_multi_threaded never block");
+    static_assert(!singularity_readers_exclude_writers< instrumented<lock_free_get>::policy<Probe> >::value,
+        "the readers of lock_free_get take no guard");
+    static_assert(singularity_thread_safe< instrumented<lock_free_get>::policy<Probe> >::value,
+        "lock_free_get is thread safe");
+    static_assert(!singularity_thread_safe< instrumented<single_threaded>::policy<Probe> >::value,
+        "single_threaded is not thread safe");
+    BOOST_CHECK(!singularity_thread_safe< single_threaded<Probe> >::value);
+}
+
+BOOST_AUTO_TEST_CASE(instrumentedPolicyShouldRecordStats) {
+    typedef singularity<Probe, instrumented<multi_threaded>::policy> singularityType;
+
+    singularity_stats const & stats = singularity_stats_of<Probe>();
+    BOOST_CHECK_EQUAL(stats.constructions.load(), 0u);
+
+    singularity_stats_registry::set_trace(&countEvent);
+    singularityType::create_global(5);
+    singularity_stats_registry::set_trace(0);
+    BOOST_CHECK_EQUAL(sTraced.load(), 1);
+    BOOST_CHECK_EQUAL(stats.constructions.load(), 1u);
+    BOOST_CHECK_EQUAL(stats.acquisitions.load(), 1u);
+
+    for (int i = 0; i < BOOST_SINGULARITY_STATS_SAMPLE_RATE; ++i) {
+        BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 5);
+    }
+    BOOST_CHECK_EQUAL(stats.accesses.load(), static_cast<unsigned long long>(BOOST_SINGULARITY_STATS_SAMPLE_RATE));
+    BOOST_CHECK_EQUAL(stats.acquisitions.load(), 1u + BOOST_SINGULARITY_STATS_SAMPLE_RATE);
+
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(stats.destructions.load(), 1u);
+    BOOST_CHECK_EQUAL(sTraced.load(), 1);
+
+    bool listed = false;
+    singularity_stats_registry::for_each([&](singularity_stats const & s) { listed = listed || &s == &stats; });
+    BOOST_CHECK(listed);
+    BOOST_CHECK_EQUAL(stats.name, typeid(Probe).name());
+}
+
+BOOST_AUTO_TEST_CASE(instrumentedPolicyShouldNotTimeATrivialReadGuard) {
+    typedef singularity<Sampled, instrumented<lock_free_get>::policy> singularityType;
+
+    singularity_stats const & stats = singularity_stats_of<Sampled>();
+    singularityType::create_global(6);
+    BOOST_CHECK_EQUAL(stats.acquisitions.load(), 1u);
+    unsigned long long const waited = stats.lock_wait_time.load();
+    unsigned long long const held = stats.lock_hold_time.load();
+
+    for (int i = 0; i < BOOST_SINGULARITY_STATS_SAMPLE_RATE - 1; ++i) {
+        BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 6);
+    }
+    BOOST_CHECK_EQUAL(stats.acquisitions.load(), 1u);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 6);
+    BOOST_CHECK_EQUAL(stats.acquisitions.load(), 1u + BOOST_SINGULARITY_STATS_SAMPLE_RATE);
+    BOOST_CHECK_EQUAL(stats.lock_wait_time.load(), waited);
+    BOOST_CHECK_EQUAL(stats.lock_hold_time.load(), held);
+
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(stats.acquisitions.load(), 2u + BOOST_SINGULARITY_STATS_SAMPLE_RATE);
+}
+
+BOOST_AUTO_TEST_CASE(sharedMemoryStorageShouldShareAcrossProcesses) {
+    typedef shared_memory_storage<Shared> storageType;
+    typedef singularity<Shared, multi_threaded, shared_memory_storage> singularityType;
+
+    std::string const name = "singularity_unittests_" + std::to_string(getpid());
+    storageType::use(name.c_str(), 65536);
+
+    // The child never saw the instance, so it must attach to it.
+    pid_t const child = fork();
+    BOOST_REQUIRE(child >= 0);
+    if (child == 0) {
+        int status = 1;
+        for (int i = 0; i < 5000 && status == 1; ++i) {
+            Shared * shared = singularityType::try_get_global();
+            if (shared == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            } else {
+                status = shared->mValues.size() == 4 && shared->mValues[3] == 9 ? 0 : 2;
+                ++shared->mHits;
+            }
+        }
+        if (status == 0) {
+            singularityType::destroy();
+            status = singularityType::try_create_global(1) == 0 ? 0 : 3;
+        }
+        _exit(status);
+    }
+
+    singularityType::create_global(4);
+    int status = -1;
+    BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+    BOOST_CHECK(WIFEXITED(status));
+    BOOST_CHECK_EQUAL(WEXITSTATUS(status), 0);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mHits.load(), 1);
+
+    singularityType::destroy();
+    BOOST_CHECK(!storageType::attachment::exists());
+}
+
+BOOST_AUTO_TEST_CASE(sharedMemoryStorageShouldFindNothingBeforeUse) {
+    typedef singularity<Unnamed, multi_threaded, shared_memory_storage> singularityType;
+
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+    singularityType::declare_global();
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(sharedMemoryStorageShouldOutliveForkedChildren) {
+    typedef shared_memory_storage<Shared> storageType;
+    typedef singularity<Shared, multi_threaded, shared_memory_storage> singularityType;
+
+    std::string const name = "singularity_unittests_forked_" + std::to_string(getpid());
+    storageType::use(name.c_str(), 65536);
+    singularityType::create_global(4);
+
+    // Each child inherits the instance, and exits normally, once after
+    // destroy() and once leaving it to the reaper, without removing it.
+    for (int explicitly = 0; explicitly < 2; ++explicitly) {
+        std::fflush(0);
+        pid_t const child = fork();
+        BOOST_REQUIRE(child >= 0);
+        if (child == 0) {
+            ++singularityType::get_global().mHits;
+            if (explicitly) {
+                singularityType::destroy();
+            }
+            std::exit(0);
+        }
+        int status = -1;
+        BOOST_REQUIRE_EQUAL(waitpid(child, &status, 0), child);
+        BOOST_CHECK(WIFEXITED(status));
+        BOOST_CHECK(storageType::attachment::exists());
+    }
+
+    Shared & shared = singularityType::get_global();
+    BOOST_CHECK_EQUAL(shared.mHits.load(), 2);
+    BOOST_CHECK_EQUAL(shared.mValues.size(), 4u);
+    BOOST_CHECK_EQUAL(shared.mValues[3], 9);
+
+    singularityType::destroy();
+    BOOST_CHECK(!storageType::attachment::exists());
+}
+
+BOOST_AUTO_TEST_CASE(createFromSnapshotShouldRestoreTheSavedImage) {
+    typedef singularity<Lookup, multi_threaded> singularityType;
+
+    std::string const path = "/tmp/singularity_unittests_" + std::to_string(getpid()) + ".image";
+    BOOST_CHECK_THROW(singularityType::save_snapshot(path.c_str()), boost::singularity_not_created);
+    BOOST_CHECK_THROW(singularityType::create_from_snapshot(path.c_str()), boost::singularity_invalid_snapshot);
+
+    singularityType::create_global(3).mValues[0] = 42;
+    singularityType::save_snapshot(path.c_str());
+    BOOST_CHECK_THROW(singularityType::create_from_snapshot(path.c_str()), boost::singularity_already_created);
+    singularityType::destroy();
+
+    Lookup & restored = singularityType::create_from_snapshot(path.c_str());
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &restored);
+    BOOST_CHECK_EQUAL(restored.mValues[0], 42);
+    BOOST_CHECK_EQUAL(restored.mValues[1023], 3 * 1023);
+    singularityType::destroy();
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+
+    // An image of another size is refused.
+    std::FILE * file = std::fopen(path.c_str(), "r+b");
+    BOOST_REQUIRE(file != 0);
+    std::fseek(file, 8, SEEK_SET);
+    std::fputc(1, file);
+    std::fclose(file);
+    BOOST_CHECK_THROW(singularityType::create_from_snapshot(path.c_str()), boost::singularity_invalid_snapshot);
+    std::remove(path.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(recreateShouldReuseTheStorage) {
+    typedef singularity<Event, multi_threaded, arena_storage> singularityType;
+
+    CountingArena arena;
+    arena_storage<Event>::use(arena);
+
+    BOOST_CHECK_THROW(singularityType::recreate(1), boost::singularity_not_created);
+    Event & event = singularityType::create_global(1);
+    for (int i = 2; i <= 100; ++i) {
+        BOOST_CHECK_EQUAL(&singularityType::recreate(i), &event);
+    }
+    BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 100);
+    BOOST_CHECK_EQUAL(arena.mAllocations, 1);
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 0);
+
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 1);
+}
+
+BOOST_AUTO_TEST_CASE(compactStateShouldFitInOneWord) {
+    typedef singularity<Flag, compact_multi_threaded, static_storage> singularityType;
+
+    BOOST_CHECK_EQUAL(sizeof(boost::detail::singularity_pointer<Flag>), sizeof(void *));
+
+    Flag * instances[4];
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.push_back(std::thread([&instances, i] {
+            instances[i] = &singularityType::create_or_get_global(static_cast<char>('a' + i));
+        }));
+    }
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+    for (int i = 1; i < 4; ++i) {
+        BOOST_CHECK_EQUAL(instances[i], instances[0]);
+    }
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), instances[0]);
+    BOOST_CHECK_THROW(singularityType::create_global('z'), boost::singularity_already_created);
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::get_global(), boost::singularity_not_created);
+
+    singularityType::create('b');
+    BOOST_CHECK_THROW(singularityType::get_global(), boost::singularity_no_global_access);
+    singularityType::destroy();
+}
+
 } // namespace anonymous
@@ -34,22 +34,43 @@
 #define SINGULARITY_HPP
 
 #include <exception>
-#include <boost/scoped_ptr.hpp>
+#include <boost/assert.hpp>
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/mpl/assert.hpp>
+#include <boost/mpl/has_xxx.hpp>
+#include <boost/throw_exception.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include <boost/type_traits/is_same.hpp>
+#include <boost/preprocessor/cat.hpp>
 #include <boost/preprocessor/control/if.hpp>
 #include <boost/preprocessor/punctuation/comma_if.hpp>
 #include <boost/preprocessor/repetition/repeat.hpp>
-#include <boost/preprocessor/repetition/repeat_from_to.hpp>
+#include <boost/preprocessor/repetition/enum_binary_params.hpp>
 #include <boost/preprocessor/repetition/enum_params.hpp>
 #include <boost/preprocessor/arithmetic/inc.hpp>
+#include <boost/preprocessor/arithmetic/dec.hpp>
 #include <boost/preprocessor/arithmetic/div.hpp>
 #include <boost/preprocessor/arithmetic/mod.hpp>
 #include <detail/pow2.hpp>
-
+#include <boost/preprocessor/comparison/less.hpp>
+#include <boost/preprocessor/comparison/less_equal.hpp>
+#include <boost/preprocessor/logical/bool.hpp>
+
+// Define BOOST_SINGULARITY_LIGHTWEIGHT to include only the single_threaded
+// policy, so that translation units which need no other policy do without
+// the threading library.  The others are then in "singularity_policies.hpp".
+#include <singularity_single_threaded.hpp>
+#ifndef BOOST_SINGULARITY_LIGHTWEIGHT
 #include <singularity_policies.hpp>
+#endif
+#include <singularity_storage.hpp>
 
 // The user can choose a different arbitrary upper limit to the
-// maximum number of constructor arguments.
+// maximum number of constructor arguments, which is one less than
+// BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE.  Up to
+// BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE arguments, temporaries and
+// non-const references may be mixed freely.
 #ifndef BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE
 #define BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE 3
 #endif
@@ -92,164 +113,832 @@ struct singularity_no_global_access : virtual std::exception
     }
 };
 
+// Specialize singularity_leak_at_exit for a type T, or define
+// BOOST_SINGULARITY_LEAK_AT_EXIT for every type, to leave an instance
+// which was never destroyed to the operating system when the program
+// exits.  No destructor is then registered for it, while an explicit
+// destroy() still runs the destructor of T as usual.
+#ifdef BOOST_SINGULARITY_LEAK_AT_EXIT
+template <class T> struct singularity_leak_at_exit : ::boost::integral_constant<bool, true> {};
+#else
+template <class T> struct singularity_leak_at_exit : ::boost::integral_constant<bool, false> {};
+#endif
+
+// Specialize singularity_compact_state for a type T, or define
+// BOOST_SINGULARITY_COMPACT_STATE for every type, to keep the instance
+// pointer, the global access flag, and the lock of compact_multi_threaded
+// together in a single word.  The instance must then be aligned to at
+// least four bytes, which the storage policies of singularity ensure.
+#ifdef BOOST_SINGULARITY_COMPACT_STATE
+template <class T> struct singularity_compact_state : ::boost::integral_constant<bool, true> {};
+#else
+template <class T> struct singularity_compact_state : ::boost::integral_constant<bool, false> {};
+#endif
+
 namespace detail {
 
-// This pointer only depends on type T, so regardless of the threading
-// model, only one singularity of type T can be created.
+template <class T> struct singularity_reaper;
+template <class T> struct singularity_declaration;
+
+// The instance pointer, and the flag which grants it global access.  The
+// flag is stored before the pointer is published, so a reader which
+// acquires the pointer also observes the flag.  The flag is left as is
+// when the pointer is cleared, so get_global() can still tell why it
+// failed.
+template <class T, bool = singularity_compact_state<T>::value> class singularity_pointer
+{
+public:
+    inline singularity_pointer() : instance(0), global(false) {}
+
+    inline T* load(memory_order order) const
+    {
+        return instance.load(order);
+    }
+    inline void store(T * pointer, memory_order order)
+    {
+        instance.store(pointer, order);
+    }
+    inline bool global_enabled() const
+    {
+        return global.load(memory_order_relaxed);
+    }
+    // Acquires the instance, or returns 0 if it has no global access.
+    inline T* load_global() const
+    {
+        T * pointer = instance.load(memory_order_acquire);
+        if (global.load(memory_order_relaxed) == false)
+        {
+            return 0;
+        }
+        return pointer;
+    }
+    inline void publish(T * pointer, bool enabled)
+    {
+        global.store(enabled, memory_order_relaxed);
+        instance.store(pointer, memory_order_release);
+    }
+private:
+    ::boost::atomic<T *> instance;
+    ::boost::atomic<bool> global;
+};
+
+// Packs the flag and a lock bit into the low bits of the pointer, so
+// get_global() reads one word and tests one bit.  Only the holder of
+// the lock bit writes the word, and it keeps the bit set while it does.
+template <class T> class singularity_pointer<T, true>
+{
+public:
+    inline singularity_pointer() : word(0) {}
+
+    inline T* load(memory_order order) const
+    {
+        return reinterpret_cast<T *>(word.load(order) & ~tag_bits);
+    }
+    inline void store(T * pointer, memory_order order)
+    {
+        word.store(tag(pointer) | (word.load(memory_order_relaxed) & tag_bits), order);
+    }
+    inline bool global_enabled() const
+    {
+        return (word.load(memory_order_relaxed) & global_bit) != 0;
+    }
+    inline T* load_global() const
+    {
+        ::boost::uintptr_t const value = word.load(memory_order_acquire);
+        return (value & global_bit) != 0 ? reinterpret_cast<T *>(value & ~tag_bits) : 0;
+    }
+    inline void publish(T * pointer, bool enabled)
+    {
+        word.store(tag(pointer) | (enabled ? global_bit : 0) | (word.load(memory_order_relaxed) & lock_bit),
+                   memory_order_release);
+    }
+
+    // The lock of compact_multi_threaded, which is only tried while it
+    // looks free, so that waiters never write the word of the holder.
+    inline bool try_lock()
+    {
+        ::boost::uintptr_t value = word.load(memory_order_relaxed);
+        return (value & lock_bit) == 0
+            && word.compare_exchange_weak(value, value | lock_bit, memory_order_acquire, memory_order_relaxed);
+    }
+    inline void unlock()
+    {
+        word.fetch_and(~lock_bit, memory_order_release);
+    }
+private:
+    static ::boost::uintptr_t const global_bit = 1;
+    static ::boost::uintptr_t const lock_bit = 2;
+    static ::boost::uintptr_t const tag_bits = global_bit | lock_bit;
+
+    static inline ::boost::uintptr_t tag(T * pointer)
+    {
+        BOOST_ASSERT((reinterpret_cast< ::boost::uintptr_t >(pointer) & tag_bits) == 0);
+        return reinterpret_cast< ::boost::uintptr_t >(pointer);
+    }
+
+    ::boost::atomic< ::boost::uintptr_t > word;
+};
+
+// The state of a singularity only depends on type T, so regardless of
+// the threading model, only one singularity of type T can be created.
+// The pointer is published with release semantics, so policies which do
+// not lock in get_global() can read it with a single acquire load.  The
+// destroyer is recorded on creation, so the instance is always returned
+// to the storage policy which supplied it.  The pointer read by
+// get_global() is kept first, and the state is given a cache line of its
+// own when BOOST_SINGULARITY_CACHE_LINE_SIZE is defined.  The declaration
+// holds the arguments of declare_global() until the first get_global()
+// builds the instance, and is only read when ptr is 0.
+template <class T> struct BOOST_SINGULARITY_CACHE_ALIGNED singularity_state
+{
+    inline singularity_state() : ptr(), declared(0), destroyer(0) {}
+
+    singularity_pointer<T> ptr;
+    ::boost::atomic<singularity_declaration<T> *> declared;
+    void (*destroyer)(T *);
+};
+
 template <class T> struct singularity_instance
 {
-    typedef ::boost::scoped_ptr<T> ptrtype;
-    static bool get_enabled;
-    static ptrtype ptr;
+    static singularity_state<T> state;
+    static singularity_reaper<T> reaper;
+};
+
+// Destroys an instance which was never destroyed when the program exits,
+// or the arguments of a declaration which was never built.
+template <class T> struct singularity_reaper
+{
+    inline ~singularity_reaper()
+    {
+        T * instance = singularity_instance<T>::state.ptr.load(memory_order_relaxed);
+        if (instance != 0)
+        {
+            singularity_instance<T>::state.destroyer(instance);
+        }
+        delete singularity_instance<T>::state.declared.load(memory_order_relaxed);
+    }
 };
 
-template <class T> bool singularity_instance<T>::get_enabled = false;
-template <class T> typename singularity_instance<T>::ptrtype singularity_instance<T>::ptr(0);
+// The constructor arguments stored by declare_global().
+template <class T> struct singularity_declaration
+{
+    virtual ~singularity_declaration() {}
+    virtual T * construct(void * memory) = 0;
+};
+
+// Retires the declaration being built once the instance is published.
+// Until then, the declaration stays visible, so racing callers wait on
+// the policy guard for the instance.  If the constructor throws, the
+// declaration is kept, and the next get_global() builds it again.
+template <class T> class singularity_declaration_guard
+{
+public:
+    inline singularity_declaration_guard()
+      : declared(singularity_instance<T>::state.declared.load(memory_order_relaxed)), built(false) {}
+    inline ~singularity_declaration_guard()
+    {
+        if (built)
+        {
+            singularity_instance<T>::state.declared.store(0, memory_order_release);
+            delete declared;
+        }
+    }
+    inline singularity_declaration<T> * get() const
+    {
+        return declared;
+    }
+    // Called once the instance was constructed.
+    inline void retire()
+    {
+        built = true;
+    }
+private:
+    singularity_declaration_guard(singularity_declaration_guard const &);
+    singularity_declaration_guard & operator=(singularity_declaration_guard const &);
+
+    singularity_declaration<T> * declared;
+    bool built;
+};
+
+template <class T> singularity_state<T> singularity_instance<T>::state;
+template <class T> singularity_reaper<T> singularity_instance<T>::reaper;
+
+// Only odr-using the reaper instantiates it, and registers its destructor.
+template <class T, bool = singularity_leak_at_exit<T>::value> struct singularity_exit
+{
+    static inline void enlist()
+    {
+        (void)&singularity_instance<T>::reaper;
+    }
+};
+
+template <class T> struct singularity_exit<T, true>
+{
+    static inline void enlist() {}
+};
+
+// A policy may nominate a lighter guard for get_global() by declaring
+// a nested read_guard type.  Otherwise the policy itself is used.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(read_guard)
+
+template <class P, bool = has_read_guard<P>::value> struct singularity_read_guard
+{
+    typedef P type;
+};
+
+template <class P> struct singularity_read_guard<P, true>
+{
+    typedef typename P::read_guard type;
+};
+
+// A policy whose readers do not block writers declares a nested
+// grace_period type, which waits in its constructor until no reader can
+// still see an instance which was unpublished.  Otherwise nothing waits.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(grace_period)
+
+struct singularity_no_grace_period {};
+
+template <class P, bool = has_grace_period<P>::value> struct singularity_grace_period
+{
+    typedef singularity_no_grace_period type;
+};
+
+template <class P> struct singularity_grace_period<P, true>
+{
+    typedef typename P::grace_period type;
+};
+
+// A policy whose read_guard excludes the writers, so that recreate() may
+// destroy the instance in place while no reader can see it, declares a
+// nested readers_exclude_writers type, whose value is true.  A policy
+// deriving from one whose readers do not hold the guard redeclares it.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(readers_exclude_writers)
+
+template <class P, bool = has_readers_exclude_writers<P>::value> struct singularity_readers_exclude_writers : ::boost::false_type {};
+
+template <class P> struct singularity_readers_exclude_writers<P, true>
+  : ::boost::integral_constant<bool, P::readers_exclude_writers::value> {};
+
+// A policy which measures singularity declares a nested instrumentation
+// type.  It is told when each instance is about to be constructed, when
+// it was constructed and destroyed, and when it is looked up.  Otherwise
+// every hook is an empty inline function, and compiles to nothing.
+BOOST_MPL_HAS_XXX_TRAIT_DEF(instrumentation)
+
+struct singularity_no_instrumentation
+{
+    struct stamp {};
+    static inline stamp start()
+    {
+        return stamp();
+    }
+    static inline void constructed(stamp) {}
+    static inline void destroyed(stamp) {}
+    static inline void accessed() {}
+};
+
+template <class P, bool = has_instrumentation<P>::value> struct singularity_instrumentation
+{
+    typedef singularity_no_instrumentation type;
+};
+
+template <class P> struct singularity_instrumentation<P, true>
+{
+    typedef typename P::instrumentation type;
+};
 
 } // detail namespace
 
+// The access tags are the last template argument of singularity.  With
+// selectable_access, calling create() or create_global() decides at
+// runtime whether get_global() may be used.  With global_access, only
+// create_global() is available, so get_global() performs no check.
+struct selectable_access {};
+struct global_access {};
+
 // And now, presenting the singularity class itself.
-template <class T, template <class T> class M = single_threaded>
+template <class T, template <class> class M = single_threaded, template <class> class S = heap_storage, class G = selectable_access>
 class singularity
 {
 public:
-// Generate the 2^(n+1)-1 which is O(2^n) create(...) function overloads
-// where n is the maximum number of constructor arguments.
+// Generate the 2^na combinations of const and non-const reference
+// create(...) overloads for up to BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE
+// arguments, so temporaries and non-const references may be mixed freely.
+// Above that, only two overloads are generated for each number of
+// arguments, so their number only grows linearly: one takes every argument
+// by non-const reference, and the other every argument by const reference.
+// A call which mixes them must then wrap its temporaries in boost::cref().
+// A non-const reference also binds const l-values, and the r-values of
+// boost::move(), which select the move constructors of the arguments of
+// T, while temporaries are copied through their const reference.  Each
+// overload of create() is layered on the matching try_create(), which
+// returns 0 instead of throwing when the instance already exists.
 //
 // na = Number of arguments
 // n  = Argument Index
-// fi = Function Index
-#define SINGULARITY_CREATE_ARGUMENTS(z, n, fi) BOOST_PP_COMMA_IF(n) A##n BOOST_PP_IF(BOOST_PP_MOD(BOOST_PP_IF(n,BOOST_PP_DIV(fi,BOOST_PP_POW2(n)),fi),2),const &,&) arg##n
+// fi = Function Index, whose bit n makes argument n a const reference, and
+//      above BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE, any bit every one
+#define SINGULARITY_CONST_BIT(n, fi) BOOST_PP_MOD(BOOST_PP_DIV(fi,BOOST_PP_POW2(n)),2)
+#define SINGULARITY_CONST_ANY(n, fi) BOOST_PP_BOOL(fi)
+#define SINGULARITY_CREATE_ARGUMENTS(z, n, fi) BOOST_PP_COMMA_IF(n) A##n \
+    BOOST_PP_IF(BOOST_PP_IF(BOOST_PP_LESS(n, BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE), \
+                            SINGULARITY_CONST_BIT, SINGULARITY_CONST_ANY)(n, fi),const &,&) arg##n
 
 #define SINGULARITY_CREATE_BODY(z, fi, na) \
     BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
-    static inline T& create( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
+    static inline T* try_create( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
     { \
+        verify_create_allowed(); \
+        \
         M<T> guard; \
         (void)guard; \
         \
-        verify_not_created(); \
+        if (is_created()) \
+        { \
+            return 0; \
+        } \
         \
-        detail::singularity_instance<T>::get_enabled = false; \
-        detail::singularity_instance<T>::ptr.reset(new T(BOOST_PP_ENUM_PARAMS(na, arg))); \
-        return *detail::singularity_instance<T>::ptr; \
+        typename instrumentation::stamp const started = instrumentation::start(); \
+        detail::singularity_storage_guard< S<T> > storage; \
+        T * instance = new (storage.get()) T(BOOST_PP_ENUM_PARAMS(na, arg)); \
+        storage.release(); \
+        instrumentation::constructed(started); \
+        return publish(instance, false); \
+    } \
+    \
+    BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
+    static inline T& create( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
+    { \
+        return verify_not_created(try_create(BOOST_PP_ENUM_PARAMS(na, arg))); \
     }
 
 #define SINGULARITY_CREATE_ENABLE_GET_BODY(z, fi, na) \
     BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
-    static inline T& create_global( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
+    static inline T* try_create_global( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
     { \
         M<T> guard; \
         (void)guard; \
         \
-        verify_not_created(); \
+        if (is_created()) \
+        { \
+            return 0; \
+        } \
         \
-        detail::singularity_instance<T>::get_enabled = true; \
-        detail::singularity_instance<T>::ptr.reset(new T(BOOST_PP_ENUM_PARAMS(na, arg))); \
-        return *detail::singularity_instance<T>::ptr; \
+        typename instrumentation::stamp const started = instrumentation::start(); \
+        detail::singularity_storage_guard< S<T> > storage; \
+        T * instance = new (storage.get()) T(BOOST_PP_ENUM_PARAMS(na, arg)); \
+        storage.release(); \
+        instrumentation::constructed(started); \
+        return publish(instance, true); \
+    } \
+    \
+    BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
+    static inline T& create_global( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
+    { \
+        return verify_not_created(try_create_global(BOOST_PP_ENUM_PARAMS(na, arg))); \
     }
 
-#define SINGULARITY_CREATE_OVERLOADS(z, na, text) BOOST_PP_REPEAT(BOOST_PP_POW2(na), SINGULARITY_CREATE_BODY, na)
-#define SINGULARITY_CREATE_ENABLE_GET_OVERLOADS(z, na, text) BOOST_PP_REPEAT(BOOST_PP_POW2(na), SINGULARITY_CREATE_ENABLE_GET_BODY, na)
-
-BOOST_PP_REPEAT(BOOST_PP_INC(BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE), \
-                SINGULARITY_CREATE_OVERLOADS, _)
-
-BOOST_PP_REPEAT(BOOST_PP_INC(BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE), \
-                SINGULARITY_CREATE_ENABLE_GET_OVERLOADS, _)
-
-#undef SINGULARITY_CREATE_OVERLOADS
-#undef SINGULARITY_CREATE_ENABLE_GET_OVERLOADS
-#undef SINGULARITY_CREATE_BODY
-#undef SINGULARITY_CREATE_ENABLE_GET_BODY
-#undef SINGULARITY_CREATE_ARGUMENTS
-
-// Generates: Family of create(...) functions
-#define SINGULARITY_CREATE_ARGUMENTS(z, n, text) BOOST_PP_COMMA_IF(n) A##n & arg##n
-
-#define SINGULARITY_CREATE_BODY(z, n, text) \
-    BOOST_PP_IF(n,template <,) BOOST_PP_ENUM_PARAMS(n, class A) BOOST_PP_IF(n,>,) \
-    static inline T& create( BOOST_PP_REPEAT(n, SINGULARITY_CREATE_ARGUMENTS, _) ) \
+// Each overload of create_or_get_global() returns the global instance,
+// and constructs it from the arguments first if there is none, so racing
+// threads construct it exactly once without catching an exception.  Once
+// the instance is published, this is a single acquire load, without the
+// policy guard.  Throws singularity_no_global_access if it was created
+// by create().
+#define SINGULARITY_CREATE_OR_GET_GLOBAL_BODY(z, fi, na) \
+    BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
+    static inline T& create_or_get_global( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
     { \
-        M<T> guard; \
-        (void)guard; \
+        instrumentation::accessed(); \
+        \
+        T * instance = lookup_global(G()); \
+        if (instance != 0) \
+        { \
+            return *instance; \
+        } \
         \
-        verify_not_created(); \
+        { \
+            M<T> guard; \
+            (void)guard; \
+            \
+            if (!is_created()) \
+            { \
+                typename instrumentation::stamp const started = instrumentation::start(); \
+                detail::singularity_storage_guard< S<T> > storage; \
+                instance = new (storage.get()) T(BOOST_PP_ENUM_PARAMS(na, arg)); \
+                storage.release(); \
+                instrumentation::constructed(started); \
+                return *publish(instance, true); \
+            } \
+            instance = lookup_global(G()); \
+        } \
         \
-        detail::singularity_instance<T>::get_enabled = false; \
-        detail::singularity_instance<T>::ptr.reset(new T(BOOST_PP_ENUM_PARAMS(n, arg))); \
-        return *detail::singularity_instance<T>::ptr; \
+        return instance != 0 ? *instance : get_global(); \
     }
 
-#define SINGULARITY_CREATE_ENABLE_GET_BODY(z, n, text) \
-    BOOST_PP_IF(n,template <,) BOOST_PP_ENUM_PARAMS(n, class A) BOOST_PP_IF(n,>,) \
-    static inline T& create_global( BOOST_PP_REPEAT(n, SINGULARITY_CREATE_ARGUMENTS, _) ) \
+// Each overload of replace() constructs a new instance, without holding
+// the policy guard, and publishes it in place of the current one, so
+// get_global() never fails in between.  With rcu_multi_threaded, the
+// current instance is destroyed once every global_reader which may still
+// use it is gone.  Throws singularity_not_created if there is no instance.
+#define SINGULARITY_REPLACE_BODY(z, fi, na) \
+    BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
+    static inline T& replace( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
+    { \
+        verify_replace_allowed(); \
+        \
+        typename instrumentation::stamp const started = instrumentation::start(); \
+        detail::singularity_storage_guard< S<T> > storage; \
+        T * replacement = new (storage.get()) T(BOOST_PP_ENUM_PARAMS(na, arg)); \
+        storage.release(); \
+        instrumentation::constructed(started); \
+        return replace_instance(replacement); \
+    }
+
+// Each overload of recreate() destroys the instance and constructs a new
+// one in the same memory, under a single acquisition of the policy guard,
+// so the storage policy is never involved and the instance is never
+// unpublished.  Policies whose readers do not take the guard are refused.
+// The arguments must not refer to the instance.  If the constructor
+// throws, the instance is gone as after destroy().
+#define SINGULARITY_RECREATE_BODY(z, fi, na) \
+    BOOST_PP_IF(na,template <,) BOOST_PP_ENUM_PARAMS(na, class A) BOOST_PP_IF(na,>,) \
+    static inline T& recreate( BOOST_PP_REPEAT(na, SINGULARITY_CREATE_ARGUMENTS, fi) ) \
     { \
+        verify_recreate_allowed(); \
+        \
         M<T> guard; \
         (void)guard; \
         \
-        verify_not_created(); \
-        \
-        detail::singularity_instance<T>::get_enabled = true; \
-        detail::singularity_instance<T>::ptr.reset(new T(BOOST_PP_ENUM_PARAMS(n, arg))); \
-        return *detail::singularity_instance<T>::ptr; \
+        T * instance = destroy_in_place(); \
+        try \
+        { \
+            typename instrumentation::stamp const started = instrumentation::start(); \
+            new (instance) T(BOOST_PP_ENUM_PARAMS(na, arg)); \
+            instrumentation::constructed(started); \
+        } \
+        catch (...) \
+        { \
+            abandon_in_place(instance); \
+            throw; \
+        } \
+        return *instance; \
     }
 
-    BOOST_PP_REPEAT_FROM_TO(BOOST_PP_INC(BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE), \
-                            BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, \
-                            SINGULARITY_CREATE_BODY, _)
+// Generates every combination for na arguments, or only the two overloads
+// whose arguments are all non-const, then all const, references.
+#define SINGULARITY_EVERY_OVERLOAD(z, na, body) BOOST_PP_REPEAT(BOOST_PP_POW2(na), body, na)
+#define SINGULARITY_CONST_ALL(bits) BOOST_PP_DEC(BOOST_PP_POW2(bits))
+#define SINGULARITY_LINEAR_OVERLOADS(z, na, body) \
+    body(z, 0, na) body(z, SINGULARITY_CONST_ALL(BOOST_PP_INC(BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE)), na)
+#define SINGULARITY_OVERLOADS(z, na, body) \
+    BOOST_PP_IF(BOOST_PP_LESS_EQUAL(na, BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE), \
+                SINGULARITY_EVERY_OVERLOAD, SINGULARITY_LINEAR_OVERLOADS)(z, na, body)
 
-    BOOST_PP_REPEAT_FROM_TO(BOOST_PP_INC(BOOST_SINGULARITY_PERFECT_FORWARD_ARG_SIZE), \
-                            BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, \
-                            SINGULARITY_CREATE_ENABLE_GET_BODY, _)
+BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_OVERLOADS, SINGULARITY_CREATE_BODY)
 
-#undef SINGULARITY_CREATE_ARGUMENTS
+BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_OVERLOADS, SINGULARITY_CREATE_ENABLE_GET_BODY)
+
+BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_OVERLOADS, SINGULARITY_CREATE_OR_GET_GLOBAL_BODY)
+
+BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_OVERLOADS, SINGULARITY_REPLACE_BODY)
+
+BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_OVERLOADS, SINGULARITY_RECREATE_BODY)
+
+#undef SINGULARITY_OVERLOADS
+#undef SINGULARITY_LINEAR_OVERLOADS
+#undef SINGULARITY_CONST_ALL
+#undef SINGULARITY_EVERY_OVERLOAD
 #undef SINGULARITY_CREATE_BODY
 #undef SINGULARITY_CREATE_ENABLE_GET_BODY
+#undef SINGULARITY_CREATE_OR_GET_GLOBAL_BODY
+#undef SINGULARITY_REPLACE_BODY
+#undef SINGULARITY_RECREATE_BODY
+#undef SINGULARITY_CREATE_ARGUMENTS
+#undef SINGULARITY_CONST_BIT
+#undef SINGULARITY_CONST_ANY
+
+// Generate one declare_global(...) overload for each number of arguments.
+// The arguments are copied, so a reference must be wrapped in boost::ref().
+// The instance is built with global access by the first call to
+// get_global(), exactly once, even when several threads race.  If the
+// constructor throws, so does get_global(), and the next call builds the
+// instance again from the same copies.
+#define SINGULARITY_DECLARE_GLOBAL_BODY(z, n, text) \
+    BOOST_PP_IF(n,template <,) BOOST_PP_ENUM_PARAMS(n, class A) BOOST_PP_IF(n,>,) \
+    static inline void declare_global( BOOST_PP_ENUM_BINARY_PARAMS(n, A, const & arg) ) \
+    { \
+        M<T> guard; \
+        (void)guard; \
+ \
+        if (is_created()) \
+        { \
+            BOOST_THROW_EXCEPTION(singularity_already_created()); \
+        } \
+ \
+        detail::singularity_exit<T>::enlist(); \
+        detail::singularity_instance<T>::state.declared.store( \
+            new BOOST_PP_CAT(declaration, n) BOOST_PP_IF(n,<,) BOOST_PP_ENUM_PARAMS(n, A) BOOST_PP_IF(n,>,) \
+                ( BOOST_PP_ENUM_PARAMS(n, arg) ), \
+            memory_order_release); \
+    }
+
+    BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_DECLARE_GLOBAL_BODY, _)
+
+#undef SINGULARITY_DECLARE_GLOBAL_BODY
 
     static inline void destroy()
     {
         M<T> guard;
         (void)guard;
 
-        if (detail::singularity_instance<T>::ptr.get() == 0)
+        T * instance = detail::singularity_instance<T>::state.ptr.load(memory_order_relaxed);
+        if (instance == 0)
         {
-            BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+            // A declaration which was never built is simply discarded.
+            detail::singularity_declaration<T> * declared =
+                detail::singularity_instance<T>::state.declared.exchange(0, memory_order_relaxed);
+            if (declared == 0)
+            {
+                BOOST_THROW_EXCEPTION(singularity_already_destroyed());
+            }
+            delete declared;
+            return;
         }
 
-        detail::singularity_instance<T>::ptr.reset();
+        detail::singularity_instance<T>::state.ptr.store(0, memory_order_release);
+        wait_for_readers();
+        detail::singularity_instance<T>::state.destroyer(instance);
     }
 
     static inline T& get_global()
     {
+        return verify_global(try_get_global());
+    }
+
+    // Returns 0 instead of throwing when the instance was not created,
+    // or was created without global access.
+    static inline T* try_get_global()
+    {
+        instrumentation::accessed();
+
+        T * instance = lookup_global_guarded();
+        if (instance == 0)
+        {
+            instance = build_declared();
+        }
+        return instance;
+    }
+
+    // Only asserts, in debug builds, that the instance is accessible.
+    // With single_threaded, this is a single load of the instance pointer.
+    // Unlike get_global(), an instance which was declared is not built.
+    static inline T& get_global_unchecked()
+    {
+        typename detail::singularity_read_guard< M<T> >::type guard;
+        (void)guard;
+
+        instrumentation::accessed();
+        BOOST_ASSERT(lookup_global(G()) != 0);
+        return *detail::singularity_instance<T>::state.ptr.load(memory_order_acquire);
+    }
+
+    // Holds the read guard of the policy for as long as it lives, so
+    // with a shared_multi_threaded policy, destroy() cannot run while
+    // the instance is being used.  Do not call get_global() or any
+    // other member of singularity while a global_reader is alive.
+    // An instance which was declared must first be built by get_global().
+    class global_reader
+    {
+    public:
+        inline global_reader() : instance(verify_global(lookup_global(G())))
+        {
+            instrumentation::accessed();
+        }
+        inline T& operator*() const
+        {
+            return instance;
+        }
+        inline T* operator->() const
+        {
+            return &instance;
+        }
+    private:
+        global_reader(global_reader const &);
+        global_reader & operator=(global_reader const &);
+
+        typename detail::singularity_read_guard< M<T> >::type guard;
+        T & instance;
+    };
+private:
+    typedef typename detail::singularity_instrumentation< M<T> >::type instrumentation;
+
+// Generate the classes which keep the arguments of declare_global().
+#define SINGULARITY_DECLARATION_INIT(z, n, text) BOOST_PP_COMMA_IF(n) arg##n(a##n)
+#define SINGULARITY_DECLARATION_MEMBER(z, n, text) A##n arg##n;
+
+#define SINGULARITY_DECLARATION(z, n, text) \
+    BOOST_PP_IF(n,template <,) BOOST_PP_ENUM_PARAMS(n, class A) BOOST_PP_IF(n,>,) \
+    class BOOST_PP_CAT(declaration, n) : public detail::singularity_declaration<T> \
+    { \
+    public: \
+        explicit BOOST_PP_CAT(declaration, n)( BOOST_PP_ENUM_BINARY_PARAMS(n, A, const & a) ) \
+            BOOST_PP_IF(n,:,) BOOST_PP_REPEAT(n, SINGULARITY_DECLARATION_INIT, _) {} \
+        virtual T * construct(void * memory) \
+        { \
+            return new (memory) T(BOOST_PP_ENUM_PARAMS(n, arg)); \
+        } \
+    private: \
+        BOOST_PP_REPEAT(n, SINGULARITY_DECLARATION_MEMBER, _) \
+    };
+
+    BOOST_PP_REPEAT(BOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE, SINGULARITY_DECLARATION, _)
+
+#undef SINGULARITY_DECLARATION
+#undef SINGULARITY_DECLARATION_MEMBER
+#undef SINGULARITY_DECLARATION_INIT
+
+    static inline T* lookup_global(selectable_access)
+    {
+        return detail::singularity_instance<T>::state.ptr.load_global();
+    }
+
+    static inline T* lookup_global(global_access)
+    {
+        return detail::singularity_instance<T>::state.ptr.load(memory_order_acquire);
+    }
+
+    static inline T* lookup_global_guarded()
+    {
+        typename detail::singularity_read_guard< M<T> >::type guard;
+        (void)guard;
+
+        return lookup_global(G());
+    }
+
+    // Builds the declared instance under the policy guard.  Callers which
+    // lose the race find the instance published once they acquire it.
+    // Without a declaration, this only repeats the lookup, because the
+    // declaration is retired after the instance was published.
+    static inline T* build_declared()
+    {
+        if (detail::singularity_instance<T>::state.declared.load(memory_order_acquire) == 0)
+        {
+            return lookup_global_guarded();
+        }
+
         M<T> guard;
         (void)guard;
 
-        if (detail::singularity_instance<T>::get_enabled == false) {
+        detail::singularity_declaration_guard<T> declared;
+        if (declared.get() == 0)
+        {
+            return lookup_global(G());
+        }
+
+        typename instrumentation::stamp const started = instrumentation::start();
+        detail::singularity_storage_guard< S<T> > storage;
+        T * instance = declared.get()->construct(storage.get());
+        storage.release();
+        declared.retire();
+        instrumentation::constructed(started);
+        return publish(instance, true);
+    }
+
+    // Layers the throwing get_global() on top of lookup_global().
+    static inline T& verify_global(T * instance)
+    {
+        if (instance == 0)
+        {
+            throw_not_global(G());
+        }
+        return *instance;
+    }
+
+    static inline void throw_not_global(selectable_access)
+    {
+        if (!detail::singularity_instance<T>::state.ptr.global_enabled()) {
             BOOST_THROW_EXCEPTION(singularity_no_global_access());
         }
+        BOOST_THROW_EXCEPTION(singularity_not_created());
+    }
+
+    static inline void throw_not_global(global_access)
+    {
+        BOOST_THROW_EXCEPTION(singularity_not_created());
+    }
+
+    static inline void verify_create_allowed()
+    {
+        BOOST_MPL_ASSERT_MSG((!is_same<G, global_access>::value),
+            CREATE_IS_UNAVAILABLE_WITH_GLOBAL_ACCESS_USE_CREATE_GLOBAL, (T));
+    }
+
+    // An instance which was declared counts as created.
+    static inline void verify_replace_allowed()
+    {
+        BOOST_MPL_ASSERT_MSG((!is_same< S<T>, static_storage<T> >::value),
+            REPLACE_REQUIRES_A_STORAGE_POLICY_WHICH_CAN_HOLD_TWO_INSTANCES, (T));
+    }
 
-        if (detail::singularity_instance<T>::ptr.get() == 0)
+    static inline void verify_recreate_allowed()
+    {
+        BOOST_MPL_ASSERT_MSG((detail::singularity_readers_exclude_writers< M<T> >::value),
+            RECREATE_REQUIRES_A_POLICY_WHOSE_READERS_HOLD_THE_GUARD, (T));
+    }
+
+    // Runs the destructor of the published instance, which stays published
+    // because the caller holds the guard until a new one is constructed.
+    static inline T* destroy_in_place()
+    {
+        T * instance = detail::singularity_instance<T>::state.ptr.load(memory_order_relaxed);
+        if (instance == 0)
         {
             BOOST_THROW_EXCEPTION(singularity_not_created());
         }
 
-        return *detail::singularity_instance<T>::ptr;
+        typename instrumentation::stamp const started = instrumentation::start();
+        instance->~T();
+        instrumentation::destroyed(started);
+        return instance;
     }
-private:
-    static inline void verify_not_created()
+
+    // Unpublishes the memory of an instance which failed to be recreated,
+    // whose destructor already ran, so only the memory is returned.
+    static inline void abandon_in_place(T * instance)
+    {
+        detail::singularity_instance<T>::state.ptr.store(0, memory_order_release);
+        S<T>::deallocate(instance);
+    }
+
+    static inline void wait_for_readers()
+    {
+        typename detail::singularity_grace_period< M<T> >::type grace_period;
+        (void)grace_period;
+    }
+
+    // Publishes the replacement in place of the current instance, which
+    // keeps its access, and destroys the current instance only once the
+    // grace period of the policy has passed.
+    static inline T& replace_instance(T * replacement)
     {
-        if (detail::singularity_instance<T>::ptr.get() != 0)
+        M<T> guard;
+        (void)guard;
+
+        T * instance = detail::singularity_instance<T>::state.ptr.load(memory_order_relaxed);
+        if (instance == 0)
+        {
+            release(replacement);
+            BOOST_THROW_EXCEPTION(singularity_not_created());
+        }
+
+        void (*destroyer)(T *) = detail::singularity_instance<T>::state.destroyer;
+        detail::singularity_instance<T>::state.destroyer = &release;
+        detail::singularity_instance<T>::state.ptr.store(replacement, memory_order_release);
+        wait_for_readers();
+        destroyer(instance);
+        return *replacement;
+    }
+
+    static inline bool is_created()
+    {
+        return detail::singularity_instance<T>::state.ptr.load(memory_order_relaxed) != 0
+            || detail::singularity_instance<T>::state.declared.load(memory_order_relaxed) != 0;
+    }
+
+    // Layers the throwing create functions on top of the try_ functions.
+    static inline T& verify_not_created(T * instance)
+    {
+        if (instance == 0)
         {
             BOOST_THROW_EXCEPTION(singularity_already_created());
         }
+        return *instance;
+    }
+
+    // Records how the instance is destroyed, before it is published.
+    static inline T* publish(T * instance, bool global)
+    {
+        detail::singularity_exit<T>::enlist();
+        detail::singularity_instance<T>::state.destroyer = &release;
+        detail::singularity_instance<T>::state.ptr.publish(instance, global);
+        return instance;
+    }
+
+    // Destroys the instance in place and returns its memory to the
+    // storage policy which supplied it.
+    static inline void release(T * instance)
+    {
+        typename instrumentation::stamp const started = instrumentation::start();
+        instance->~T();
+        S<T>::deallocate(instance);
+        instrumentation::destroyed(started);
     }
 };
 
 // Convenience macro which generates the required friend statement
 // for use inside classes which use singularity as a factory.
 #define FRIEND_CLASS_SINGULARITY \
-    template <class T, template <class T> class M> friend class singularity
+    template <class T, template <class> class M, template <class> class S, class G> friend class singularity
 
 } // boost namespace
 
@@ -0,0 +1,307 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+// Measures the cost of every shipped policy of the C++03 singularity:
+// get_global() latency and throughput from 1 to max_threads threads,
+// create()/destroy() churn, and heap allocations per operation.
+//
+//  g++ -std=c++03 -O2 -I. singularity_benchmark.cpp -lboost_thread -lboost_chrono -pthread
+//  ./a.out [max_threads] [iterations] > results.csv
+//
+// Each result is printed as one comma separated line, after a header line.
+// Compile a second time with -DBOOST_SINGULARITY_CACHE_LINE_SIZE=64 and
+// compare the false_sharing lines to see the effect of the layout.
+//----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <boost/config.hpp>
+#include <boost/atomic.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/chrono.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+#include <singularity.hpp>
+
+namespace {
+
+using ::boost::singularity;
+using ::boost::single_threaded;
+using ::boost::multi_threaded;
+using ::boost::lock_free_get;
+using ::boost::shared_multi_threaded;
+using ::boost::spinlock_multi_threaded;
+using ::boost::adaptive_multi_threaded;
+using ::boost::rcu_multi_threaded;
+using ::boost::compact_multi_threaded;
+using ::boost::heap_storage;
+using ::boost::static_storage;
+
+::boost::atomic<unsigned long> allocations(0);
+
+} // namespace anonymous
+
+// Count every heap allocation made by the process.
+void * operator new(std::size_t size) throw(std::bad_alloc)
+{
+    allocations.fetch_add(1, ::boost::memory_order_relaxed);
+    void * memory = std::malloc(size != 0 ? size : 1);
+    if (memory == 0)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+// Releases the memory of the operator new above.  It is never inlined,
+// so that -Wmismatched-new-delete does not mistake its std::free() for a
+// mismatched release of the memory of a new-expression.
+BOOST_NOINLINE void operator delete(void * memory) throw()
+{
+    std::free(memory);
+}
+
+namespace {
+
+typedef ::boost::chrono::steady_clock clock_type;
+
+#ifdef BOOST_SINGULARITY_CACHE_LINE_SIZE
+unsigned const cache_line = BOOST_SINGULARITY_CACHE_LINE_SIZE;
+#else
+unsigned const cache_line = 0;
+#endif
+
+template <template <class> class M> struct policy_name;
+template <> struct policy_name<single_threaded>       { static char const * get() { return "single_threaded"; } };
+template <> struct policy_name<multi_threaded>        { static char const * get() { return "multi_threaded"; } };
+template <> struct policy_name<lock_free_get>         { static char const * get() { return "lock_free_get"; } };
+template <> struct policy_name<shared_multi_threaded> { static char const * get() { return "shared_multi_threaded"; } };
+template <> struct policy_name<spinlock_multi_threaded> { static char const * get() { return "spinlock_multi_threaded"; } };
+template <> struct policy_name<adaptive_multi_threaded> { static char const * get() { return "adaptive_multi_threaded"; } };
+template <> struct policy_name<rcu_multi_threaded>      { static char const * get() { return "rcu_multi_threaded"; } };
+template <> struct policy_name<compact_multi_threaded>  { static char const * get() { return "compact_multi_threaded"; } };
+
+template <template <class> class S> struct storage_name;
+template <> struct storage_name<heap_storage>   { static char const * get() { return "heap_storage"; } };
+template <> struct storage_name<static_storage> { static char const * get() { return "static_storage"; } };
+
+// One distinct singularity type for each combination of policies.
+template <template <class> class M, template <class> class S> class Payload
+{
+public:
+    Payload() : mValue(1) {}
+    int mValue;
+};
+
+} // namespace anonymous
+
+namespace boost {
+// compact_multi_threaded keeps its lock in the instance pointer.
+template <template <class> class S> struct singularity_compact_state< Payload<compact_multi_threaded, S> >
+  : ::boost::integral_constant<bool, true> {};
+} // boost namespace
+
+namespace {
+
+// Releases all the threads of a measurement at the same instant.
+class start_gate
+{
+public:
+    start_gate() : mWaiting(0), mOpen(false) {}
+    void wait()
+    {
+        mWaiting.fetch_add(1);
+        while (!mOpen.load(::boost::memory_order_acquire)) {}
+    }
+    void open(unsigned threads)
+    {
+        while (mWaiting.load() != threads) {}
+        mOpen.store(true, ::boost::memory_order_release);
+    }
+private:
+    ::boost::atomic<unsigned> mWaiting;
+    ::boost::atomic<bool> mOpen;
+};
+
+void print_header()
+{
+    std::printf("header,cache_line,policy,storage,benchmark,threads,operations,ns_per_op,ops_per_sec,allocs_per_op\n");
+}
+
+template <template <class> class M, template <class> class S>
+void report(char const * benchmark, unsigned threads, unsigned long operations,
+            clock_type::duration elapsed, unsigned long allocs)
+{
+    double const seconds = ::boost::chrono::duration<double>(elapsed).count();
+    std::printf("cpp03,%u,%s,%s,%s,%u,%lu,%.3f,%.0f,%.6f\n", cache_line,
+        policy_name<M>::get(), storage_name<S>::get(), benchmark, threads, operations,
+        seconds * 1e9 * threads / operations, operations / seconds,
+        static_cast<double>(allocs) / operations);
+}
+
+// Doubles the number of threads, finishing on exactly max_threads.
+unsigned next_thread_count(unsigned threads, unsigned max_threads)
+{
+    if (threads < max_threads && threads * 2 > max_threads)
+    {
+        return max_threads;
+    }
+    return threads * 2;
+}
+
+template <class Singularity>
+void read_global(start_gate & gate, unsigned long iterations, unsigned long & sink)
+{
+    unsigned long sum = 0;
+    gate.wait();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        sum += Singularity::get_global().mValue;
+    }
+    sink = sum;
+}
+
+template <template <class> class M, template <class> class S>
+void benchmark_get_global(unsigned max_threads, unsigned long iterations)
+{
+    typedef singularity<Payload<M, S>, M, S> singularity_type;
+
+    singularity_type::create_global();
+    for (unsigned threads = 1; threads <= max_threads; threads = next_thread_count(threads, max_threads))
+    {
+        start_gate gate;
+        std::vector<unsigned long> sinks(threads);
+        ::boost::thread_group workers;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.create_thread(::boost::bind(&read_global<singularity_type>,
+                ::boost::ref(gate), iterations, ::boost::ref(sinks[t])));
+        }
+
+        unsigned long const before = allocations.load();
+        clock_type::time_point const start = clock_type::now();
+        gate.open(threads);
+        workers.join_all();
+        clock_type::duration const elapsed = clock_type::now() - start;
+
+        report<M, S>("get_global", threads, iterations * threads, elapsed, allocations.load() - before);
+    }
+    singularity_type::destroy();
+}
+
+template <template <class> class M, template <class> class S>
+void benchmark_churn(unsigned long iterations)
+{
+    typedef singularity<Payload<M, S>, M, S> singularity_type;
+
+    unsigned long const before = allocations.load();
+    clock_type::time_point const start = clock_type::now();
+    for (unsigned long i = 0; i < iterations; ++i)
+    {
+        singularity_type::create();
+        singularity_type::destroy();
+    }
+    clock_type::duration const elapsed = clock_type::now() - start;
+
+    report<M, S>("create_destroy", 1, iterations, elapsed, allocations.load() - before);
+}
+
+template <class Singularity>
+void churn_until(::boost::atomic<bool> & stop)
+{
+    while (!stop.load(::boost::memory_order_relaxed))
+    {
+        Singularity::create();
+        Singularity::destroy();
+    }
+}
+
+// Measures get_global() on one type while another thread continuously
+// creates and destroys a second type.  Without a cache line size, the
+// mutex and state written for the second type may share cache lines with
+// the state read for the first, which slows every reader down.
+template <template <class> class M>
+void benchmark_false_sharing(unsigned max_threads, unsigned long iterations)
+{
+    typedef singularity<Payload<M, heap_storage>, M, heap_storage> reader_type;
+    typedef singularity<Payload<M, static_storage>, M, static_storage> writer_type;
+
+    reader_type::create_global();
+    for (unsigned threads = 1; threads <= max_threads; threads = next_thread_count(threads, max_threads))
+    {
+        start_gate gate;
+        ::boost::atomic<bool> stop(false);
+        std::vector<unsigned long> sinks(threads);
+        ::boost::thread_group workers;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            workers.create_thread(::boost::bind(&read_global<reader_type>,
+                ::boost::ref(gate), iterations, ::boost::ref(sinks[t])));
+        }
+        ::boost::thread writer(::boost::bind(&churn_until<writer_type>, ::boost::ref(stop)));
+
+        unsigned long const before = allocations.load();
+        clock_type::time_point const start = clock_type::now();
+        gate.open(threads);
+        workers.join_all();
+        clock_type::duration const elapsed = clock_type::now() - start;
+
+        stop.store(true);
+        writer.join();
+
+        report<M, heap_storage>("false_sharing", threads, iterations * threads, elapsed, allocations.load() - before);
+    }
+    reader_type::destroy();
+}
+
+template <template <class> class M, template <class> class S>
+void benchmark_policy(unsigned max_threads, unsigned long iterations)
+{
+    benchmark_get_global<M, S>(max_threads, iterations);
+    benchmark_churn<M, S>(iterations / 10);
+}
+
+} // namespace anonymous
+
+int main(int argc, char * argv[])
+{
+    unsigned max_threads = ::boost::thread::hardware_concurrency();
+    unsigned long iterations = 1000000;
+    if (argc > 1)
+    {
+        max_threads = static_cast<unsigned>(std::strtoul(argv[1], 0, 10));
+    }
+    if (argc > 2)
+    {
+        iterations = std::strtoul(argv[2], 0, 10);
+    }
+    if (max_threads == 0)
+    {
+        max_threads = 1;
+    }
+
+    print_header();
+    benchmark_policy<single_threaded,       heap_storage  >(1, iterations);
+    benchmark_policy<single_threaded,       static_storage>(1, iterations);
+    benchmark_policy<multi_threaded,        heap_storage  >(max_threads, iterations);
+    benchmark_policy<multi_threaded,        static_storage>(max_threads, iterations);
+    benchmark_policy<lock_free_get,         heap_storage  >(max_threads, iterations);
+    benchmark_policy<lock_free_get,         static_storage>(max_threads, iterations);
+    benchmark_policy<shared_multi_threaded, heap_storage  >(max_threads, iterations);
+    benchmark_policy<shared_multi_threaded, static_storage>(max_threads, iterations);
+    benchmark_policy<spinlock_multi_threaded, heap_storage  >(max_threads, iterations);
+    benchmark_policy<spinlock_multi_threaded, static_storage>(max_threads, iterations);
+    benchmark_policy<adaptive_multi_threaded, heap_storage  >(max_threads, iterations);
+    benchmark_policy<adaptive_multi_threaded, static_storage>(max_threads, iterations);
+    benchmark_policy<rcu_multi_threaded,    heap_storage  >(max_threads, iterations);
+    benchmark_policy<rcu_multi_threaded,    static_storage>(max_threads, iterations);
+    benchmark_policy<compact_multi_threaded, heap_storage  >(max_threads, iterations);
+    benchmark_policy<compact_multi_threaded, static_storage>(max_threads, iterations);
+    benchmark_false_sharing<lock_free_get>(max_threads, iterations);
+    return 0;
+}
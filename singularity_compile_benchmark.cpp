@@ -0,0 +1,47 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+//----------------------------------------------------------------------------
+// A translation unit which only uses a single_threaded global singularity,
+// compiled by "singularity_compile_benchmark.sh" once per configuration
+// of the headers, to measure what including singularity costs.
+//
+//  sh singularity_compile_benchmark.sh [repetitions] > results.csv
+//
+// Define SINGULARITY_BENCHMARK_CPP11 to include the C++11 header, and
+// SINGULARITY_BENCHMARK_MULTI_THREADED to use the multi_threaded policy.
+//----------------------------------------------------------------------------
+
+#ifdef SINGULARITY_BENCHMARK_CPP11
+#include <singularity_cpp11.hpp>
+#else
+#include <singularity.hpp>
+#endif
+
+#ifdef SINGULARITY_BENCHMARK_MULTI_THREADED
+#define SINGULARITY_BENCHMARK_POLICY ::boost::multi_threaded
+#else
+#define SINGULARITY_BENCHMARK_POLICY ::boost::single_threaded
+#endif
+
+namespace {
+
+class Config {
+public:
+    Config() : mValue(1) {}
+    int mValue;
+};
+
+typedef ::boost::singularity<Config, SINGULARITY_BENCHMARK_POLICY> config;
+
+} // namespace anonymous
+
+int main()
+{
+    config::create_global();
+    int const value = config::get_global().mValue;
+    config::destroy();
+    return value == 1 ? 0 : 1;
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#               Copyright Ben Robinson 2011.
+# Distributed under the Boost Software License, Version 1.0.
+#    (See accompanying file LICENSE_1_0.txt or copy at
+#          http://www.boost.org/LICENSE_1_0.txt)
+
+# Measures the preprocessed size and the compile time of including
+# singularity, for each configuration of the headers, and prints them as
+# comma separated values.  Set CXX to choose the compiler.
+#
+#  sh singularity_compile_benchmark.sh [repetitions] > results.csv
+
+CXX=${CXX:-g++}
+repetitions=${1:-5}
+cd "$(dirname "$0")" || exit 1
+source=singularity_compile_benchmark.cpp
+
+measure()
+{
+    name=$1
+    shift
+    lines=$($CXX "$@" -E $source | wc -l) || exit 1
+    start=$(date +%s%N)
+    i=0
+    while [ $i -lt $repetitions ]; do
+        $CXX "$@" -fsyntax-only $source || exit 1
+        i=$((i + 1))
+    done
+    end=$(date +%s%N)
+    echo "$name,$lines,$(( (end - start) / repetitions / 1000000 ))"
+}
+
+echo "configuration,preprocessed_lines,compile_milliseconds"
+measure cpp03 -std=c++03 -I.
+measure cpp03_lightweight -std=c++03 -I. -DBOOST_SINGULARITY_LIGHTWEIGHT
+measure cpp03_lightweight_4_arguments -std=c++03 -I. -DBOOST_SINGULARITY_LIGHTWEIGHT -DBOOST_SINGULARITY_NONCONST_REFERENCE_ARG_SIZE=5
+measure cpp03_multi_threaded -std=c++03 -I. -DSINGULARITY_BENCHMARK_MULTI_THREADED
+measure cpp11 -std=c++11 -Icpp11 -DSINGULARITY_BENCHMARK_CPP11
+measure cpp11_lightweight -std=c++11 -Icpp11 -DSINGULARITY_BENCHMARK_CPP11 -DBOOST_SINGULARITY_LIGHTWEIGHT
+measure cpp11_multi_threaded -std=c++11 -Icpp11 -DSINGULARITY_BENCHMARK_CPP11 -DSINGULARITY_BENCHMARK_MULTI_THREADED
+measure cpp14_std_thread -std=c++14 -Icpp11 -DSINGULARITY_BENCHMARK_CPP11 -DSINGULARITY_BENCHMARK_MULTI_THREADED -DBOOST_SINGULARITY_STD_THREAD
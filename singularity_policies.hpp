@@ -7,17 +7,169 @@
 #ifndef SINGULARITY_POLICIES_HPP
 #define SINGULARITY_POLICIES_HPP
 
+#include <boost/atomic.hpp>
+#include <boost/mpl/assert.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread_only.hpp>
+
+#include <singularity_single_threaded.hpp>
+
+// The spinlock policy doubles the pause between attempts until it
+// reaches BOOST_SINGULARITY_SPIN_MAX_BACKOFF iterations, after which
+// it also yields the processor to the thread holding the lock.
+#ifndef BOOST_SINGULARITY_SPIN_MAX_BACKOFF
+#define BOOST_SINGULARITY_SPIN_MAX_BACKOFF 64
+#endif
+
+// The adaptive policy tries the mutex this many times before blocking.
+#ifndef BOOST_SINGULARITY_ADAPTIVE_SPIN_COUNT
+#define BOOST_SINGULARITY_ADAPTIVE_SPIN_COUNT 100
+#endif
 
 namespace boost {
 
-// The threading model for Singularity is policy based.  The
-// single_threaded policy provides maximum performance, and
-// the multi-threaded policy provides thread safety.
+namespace detail {
+
+// Tells the processor that the calling thread is busy waiting.
+inline void singularity_cpu_relax()
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    __builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Doubles the pause between the attempts of a waiter until it reaches
+// BOOST_SINGULARITY_SPIN_MAX_BACKOFF iterations, after which it also
+// yields the processor to the thread holding the lock.
+class singularity_backoff
+{
+public:
+    inline singularity_backoff() : backoff(1) {}
+    inline void pause()
+    {
+        for (unsigned i = 0; i < backoff; ++i)
+        {
+            singularity_cpu_relax();
+        }
+        if (backoff < BOOST_SINGULARITY_SPIN_MAX_BACKOFF)
+        {
+            backoff *= 2;
+        }
+        else
+        {
+            ::boost::this_thread::yield();
+        }
+    }
+private:
+    unsigned backoff;
+};
+
+// A test and test-and-set spinlock with exponential backoff.  Waiters
+// spin on a plain load, which stays in their own cache, and only write
+// the shared line once the lock looks free.
+class singularity_spinlock
+{
+public:
+    inline singularity_spinlock() : locked(false) {}
+    inline void lock()
+    {
+        singularity_backoff backoff;
+        while (locked.exchange(true, ::boost::memory_order_acquire))
+        {
+            do
+            {
+                backoff.pause();
+            } while (locked.load(::boost::memory_order_relaxed));
+        }
+    }
+    inline bool try_lock()
+    {
+        return !locked.load(::boost::memory_order_relaxed) && !locked.exchange(true, ::boost::memory_order_acquire);
+    }
+    inline void unlock()
+    {
+        locked.store(false, ::boost::memory_order_release);
+    }
+private:
+    ::boost::atomic<bool> locked;
+};
+
+// Spins on try_lock() for a bounded number of attempts, then blocks on
+// the mutex, so short critical sections never reach the kernel while
+// long waits do not burn the processor.
+template <class L> class singularity_adaptive_lockable
+{
+public:
+    inline void lock()
+    {
+        for (unsigned i = 0; i < BOOST_SINGULARITY_ADAPTIVE_SPIN_COUNT; ++i)
+        {
+            if (lockable.try_lock())
+            {
+                return;
+            }
+            singularity_cpu_relax();
+        }
+        lockable.lock();
+    }
+    inline void unlock()
+    {
+        lockable.unlock();
+    }
+private:
+    L lockable;
+};
+
 
-// The single_threaded policy is a POD struct with
-// no mutex to maximize compiler optimizations.
-template <class T> class single_threaded {};
+// Counts the readers of each epoch, in the manner of read-copy-update.
+// A reader enters the current epoch, and only leaves it after it is done
+// with the instance it read.  A writer which unpublished an instance
+// advances the epoch, and then waits until the readers of the previous
+// epoch have all left, after which none can still see that instance.
+class singularity_rcu_domain
+{
+public:
+    inline singularity_rcu_domain() : epoch(0)
+    {
+        readers[0] = 0;
+        readers[1] = 0;
+    }
+    inline unsigned enter()
+    {
+        for (;;)
+        {
+            unsigned const current = epoch.load(::boost::memory_order_relaxed);
+            readers[current & 1].fetch_add(1, ::boost::memory_order_seq_cst);
+            if (epoch.load(::boost::memory_order_seq_cst) == current)
+            {
+                return current;
+            }
+            readers[current & 1].fetch_sub(1, ::boost::memory_order_release);
+        }
+    }
+    inline void leave(unsigned entered)
+    {
+        readers[entered & 1].fetch_sub(1, ::boost::memory_order_release);
+    }
+    // Only one writer may wait at a time, which the policy mutex ensures.
+    inline void synchronize()
+    {
+        unsigned const previous = epoch.load(::boost::memory_order_relaxed);
+        epoch.store(previous + 1, ::boost::memory_order_seq_cst);
+        while (readers[previous & 1].load(::boost::memory_order_seq_cst) != 0)
+        {
+            ::boost::this_thread::yield();
+        }
+    }
+private:
+    ::boost::atomic<unsigned> epoch;
+    ::boost::atomic<unsigned long> readers[2];
+};
+
+} // detail namespace
 
 // Users of singularity are encouraged to develop their own
 // thread-safe policies which meet their unique requirements
@@ -25,6 +177,9 @@ template <class T> class single_threaded {};
 template <class T> class multi_threaded
 {
 public:
+    typedef ::boost::true_type thread_safe;
+    typedef ::boost::true_type readers_exclude_writers;
+
     inline multi_threaded()
     {
         lockable.lock();
@@ -36,10 +191,171 @@ public:
 private:
     // The mutex acquisition and release must provide
     // fencing in order to be thread-safe.
-    static ::boost::mutex lockable;
+    static detail::singularity_lockable< ::boost::mutex > lockable;
+};
+
+template <class T> detail::singularity_lockable< ::boost::mutex > multi_threaded<T>::lockable;
+
+// The lock_free_get policy serializes create() and destroy() on the
+// multi_threaded mutex, but get_global() never acquires the mutex.  It
+// only performs an acquire load of the published instance pointer, so
+// concurrent readers neither contend nor write to shared cache lines.
+template <class T> class lock_free_get : public multi_threaded<T>
+{
+public:
+    typedef ::boost::false_type readers_exclude_writers;
+
+    struct read_guard {};
+};
+
+// The compact_multi_threaded policy serializes create() and destroy() on
+// a bit of the instance pointer itself, so a type needs no mutex of its
+// own, and get_global() is the same single acquire load as with
+// lock_free_get.  The type must use singularity_compact_state.  Waiters
+// spin with backoff, so constructors which block for long are better
+// served by multi_threaded.
+template <class T> class compact_multi_threaded
+{
+public:
+    typedef ::boost::true_type thread_safe;
+
+    inline compact_multi_threaded()
+    {
+        BOOST_MPL_ASSERT_MSG((singularity_compact_state<T>::value),
+            COMPACT_MULTI_THREADED_REQUIRES_SINGULARITY_COMPACT_STATE, (T));
+        detail::singularity_backoff backoff;
+        while (!detail::singularity_instance<T>::state.ptr.try_lock())
+        {
+            backoff.pause();
+        }
+    }
+    inline ~compact_multi_threaded()
+    {
+        detail::singularity_instance<T>::state.ptr.unlock();
+    }
+
+    struct read_guard {};
+};
+
+// The shared_multi_threaded policy sits between single_threaded and
+// multi_threaded.  create() and destroy() take the mutex exclusively,
+// while get_global() takes it shared, so readers on many cores proceed
+// together and never overlap with destroy().
+template <class T> class shared_multi_threaded
+{
+public:
+    typedef ::boost::true_type thread_safe;
+    typedef ::boost::true_type readers_exclude_writers;
+
+    inline shared_multi_threaded()
+    {
+        lockable.lock();
+    }
+    inline ~shared_multi_threaded()
+    {
+        lockable.unlock();
+    }
+
+    class read_guard
+    {
+    public:
+        inline read_guard()
+        {
+            lockable.lock_shared();
+        }
+        inline ~read_guard()
+        {
+            lockable.unlock_shared();
+        }
+    };
+private:
+    static detail::singularity_lockable< ::boost::shared_mutex > lockable;
+};
+
+template <class T> detail::singularity_lockable< ::boost::shared_mutex > shared_multi_threaded<T>::lockable;
+
+// The spinlock_multi_threaded policy serializes like multi_threaded, but
+// on a spinlock which never enters the kernel.  The critical sections of
+// singularity are only a few instructions long, so waiting threads are
+// released sooner than by a mutex, unless the holder is preempted.
+template <class T> class spinlock_multi_threaded
+{
+public:
+    typedef ::boost::true_type thread_safe;
+    typedef ::boost::true_type readers_exclude_writers;
+
+    inline spinlock_multi_threaded()
+    {
+        lockable.lock();
+    }
+    inline ~spinlock_multi_threaded()
+    {
+        lockable.unlock();
+    }
+private:
+    static detail::singularity_lockable< detail::singularity_spinlock > lockable;
+};
+
+template <class T> detail::singularity_lockable< detail::singularity_spinlock > spinlock_multi_threaded<T>::lockable;
+
+// The adaptive_multi_threaded policy spins briefly on the mutex before
+// blocking on it, combining the latency of spinlock_multi_threaded under
+// light contention with the fairness of multi_threaded under heavy load.
+template <class T> class adaptive_multi_threaded
+{
+public:
+    typedef ::boost::true_type thread_safe;
+    typedef ::boost::true_type readers_exclude_writers;
+
+    inline adaptive_multi_threaded()
+    {
+        lockable.lock();
+    }
+    inline ~adaptive_multi_threaded()
+    {
+        lockable.unlock();
+    }
+private:
+    static detail::singularity_lockable< detail::singularity_adaptive_lockable< ::boost::mutex > > lockable;
+};
+
+template <class T> detail::singularity_lockable< detail::singularity_adaptive_lockable< ::boost::mutex > > adaptive_multi_threaded<T>::lockable;
+
+// The rcu_multi_threaded policy serializes create(), destroy() and
+// replace() on the multi_threaded mutex, while readers never block.  A
+// global_reader enters a read-side critical section, and replace() or
+// destroy() wait for the grace_period of those which may still see the
+// old instance before destroying it.  Readers must therefore hold a
+// global_reader, rather than keep the reference of get_global().
+template <class T> class rcu_multi_threaded : public multi_threaded<T>
+{
+public:
+    typedef ::boost::false_type readers_exclude_writers;
+
+    class read_guard
+    {
+    public:
+        inline read_guard() : entered(domain.enter()) {}
+        inline ~read_guard()
+        {
+            domain.leave(entered);
+        }
+    private:
+        unsigned entered;
+    };
+
+    struct grace_period
+    {
+        inline grace_period()
+        {
+            domain.synchronize();
+        }
+    };
+private:
+    static detail::singularity_lockable< detail::singularity_rcu_domain > domain;
 };
 
-template <class T> ::boost::mutex multi_threaded<T>::lockable;
+template <class T> detail::singularity_lockable< detail::singularity_rcu_domain > rcu_multi_threaded<T>::domain;
 
 } // boost namespace
 
@@ -0,0 +1,51 @@
+//               Copyright Ben Robinson 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SINGULARITY_SINGLE_THREADED_HPP
+#define SINGULARITY_SINGLE_THREADED_HPP
+
+#include <boost/config.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+
+// Define BOOST_SINGULARITY_CACHE_LINE_SIZE, typically as 64, to give
+// the state of each singularity and each policy mutex a cache line of
+// its own.  Writes to the mutex of one type then never invalidate the
+// line holding the instance pointer of another type.
+#ifdef BOOST_SINGULARITY_CACHE_LINE_SIZE
+#define BOOST_SINGULARITY_CACHE_ALIGNED BOOST_ALIGNMENT(BOOST_SINGULARITY_CACHE_LINE_SIZE)
+#else
+#define BOOST_SINGULARITY_CACHE_ALIGNED
+#endif
+
+namespace boost {
+
+// Selects the layout of the state of T, see singularity_compact_state.
+template <class T> struct singularity_compact_state;
+
+namespace detail {
+
+template <class T> struct singularity_instance;
+
+// Pads the lockable of a policy to the cache line size, if requested.
+template <class L> struct BOOST_SINGULARITY_CACHE_ALIGNED singularity_lockable : L {};
+
+} // detail namespace
+
+// The threading model for Singularity is policy based.  The
+// single_threaded policy provides maximum performance, and
+// the multi-threaded policy provides thread safety.
+
+// The single_threaded policy is a POD struct with
+// no mutex to maximize compiler optimizations.  Nothing reads the
+// instance while it is recreated, since there is a single thread.
+template <class T> class single_threaded
+{
+public:
+    typedef ::boost::true_type readers_exclude_writers;
+};
+
+} // boost namespace
+
+#endif // SINGULARITY_SINGLE_THREADED_HPP
@@ -5,9 +5,12 @@
 //          http://www.boost.org/LICENSE_1_0.txt)
 
 //#define BOOST_TEST_MAIN defined
+#include <stdexcept>
 #include <boost/test/unit_test.hpp>
 #include <boost/ref.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/move/core.hpp>
+#include <boost/move/utility_core.hpp>
 #include <singularity.hpp>
 
 namespace {
@@ -15,6 +18,18 @@ namespace {
 using ::boost::singularity;
 using ::boost::single_threaded;
 using ::boost::multi_threaded;
+using ::boost::lock_free_get;
+using ::boost::shared_multi_threaded;
+using ::boost::spinlock_multi_threaded;
+using ::boost::adaptive_multi_threaded;
+using ::boost::rcu_multi_threaded;
+using ::boost::compact_multi_threaded;
+using ::boost::static_storage;
+using ::boost::heap_storage;
+using ::boost::global_access;
+using ::boost::allocator_storage;
+using ::boost::arena_storage;
+using ::boost::singularity_arena;
 using ::boost::noncopyable;
 using ::boost::cref;
 
@@ -26,6 +41,104 @@ public:
     int mValue;
 };
 
+// Refuses to be constructed as many times as the test asks.
+class Reluctant : private noncopyable {
+public:
+    explicit Reluctant(int xInt) : mInt(xInt) {
+        if (sRefusals > 0) {
+            --sRefusals;
+            throw std::runtime_error("Reluctant");
+        }
+    }
+    int mInt;
+    static int sRefusals;
+};
+
+int Reluctant::sRefusals = 0;
+
+// An arena which counts the memory it hands out.
+class CountingArena : public singularity_arena {
+public:
+    CountingArena() : mAllocations(0), mDeallocations(0) {}
+    virtual void * allocate(std::size_t size, std::size_t) {
+        ++mAllocations;
+        return ::operator new(size);
+    }
+    virtual void deallocate(void * memory, std::size_t, std::size_t) {
+        ++mDeallocations;
+        ::operator delete(memory);
+    }
+    int mAllocations;
+    int mDeallocations;
+};
+
+// Counts its destructions, and is left to the operating system at exit.
+class Leaked : private noncopyable {
+public:
+    ~Leaked() { ++sDestroyed; }
+    static int sDestroyed;
+};
+
+int Leaked::sDestroyed = 0;
+
+// Counts the calls to the instrumentation hooks of singularity.
+struct Hooks {
+    static int sConstructed;
+    static int sDestroyed;
+    static int sAccessed;
+};
+
+int Hooks::sConstructed = 0;
+int Hooks::sDestroyed = 0;
+int Hooks::sAccessed = 0;
+
+template <class T> class counted_single_threaded {
+public:
+    struct instrumentation {
+        struct stamp {};
+        static stamp start() { return stamp(); }
+        static void constructed(stamp) { ++Hooks::sConstructed; }
+        static void destroyed(stamp) { ++Hooks::sDestroyed; }
+        static void accessed() { ++Hooks::sAccessed; }
+    };
+};
+
+// Can only be moved, and counts its moves.
+class Buffer {
+    BOOST_MOVABLE_BUT_NOT_COPYABLE(Buffer)
+public:
+    Buffer(int xSize) : mSize(xSize) {}
+    Buffer(BOOST_RV_REF(Buffer) xOther) : mSize(xOther.mSize) { xOther.mSize = 0; ++sMoves; }
+    int mSize;
+    static int sMoves;
+};
+
+int Buffer::sMoves = 0;
+
+// Takes ownership of the buffer it is constructed from.
+class Channel : private noncopyable {
+public:
+    Channel(BOOST_RV_REF(Buffer) xBuffer, int xId) : mBuffer(::boost::move(xBuffer)), mId(xId) {}
+    Buffer mBuffer;
+    int mId;
+};
+
+// Keeps its state in a single word, and is only byte aligned.
+class Flag : private noncopyable {
+public:
+    Flag(char xValue) : mValue(xValue) {}
+    char mValue;
+};
+
+} // namespace anonymous
+
+namespace boost {
+template <> struct singularity_leak_at_exit<Leaked> : ::boost::integral_constant<bool, true> {};
+template <> struct singularity_compact_state<Flag> : ::boost::integral_constant<bool, true> {};
+} // boost namespace
+
+namespace {
+
 // This class demonstrates making itself a Singularity,
 // by making its constructors private, and friending
 // the Singularity.
@@ -37,6 +150,9 @@ private:
     Horizon(Event       * xEvent) : mEvent(0), mInt(0),    mEventRef(mEvent), mEventPtr(xEvent),  mConstEventRef(mEvent), mConstEventPtr(&mEvent) {}
     Horizon(Event const & xEvent) : mEvent(0), mInt(0),    mEventRef(mEvent), mEventPtr(&mEvent), mConstEventRef(xEvent), mConstEventPtr(&mEvent) {}
     Horizon(Event const * xEvent) : mEvent(0), mInt(0),    mEventRef(mEvent), mEventPtr(&mEvent), mConstEventRef(mEvent), mConstEventPtr(xEvent)  {}
+    Horizon(int xInt, Event * xEventPtr, Event & xEventRef)
+        :   mEvent(0), mInt(xInt), mEventRef(xEventRef), mEventPtr(xEventPtr),
+            mConstEventRef(mEvent), mConstEventPtr(&mEvent) {}
     Horizon(int xInt, Event & xEventRef, Event * xEventPtr,
         Event const & xConstEventRef, Event const * xConstEventPtr)
         :   mEvent(0), mInt(xInt), mEventRef(xEventRef), mEventPtr(xEventPtr),
@@ -104,6 +220,15 @@ BOOST_AUTO_TEST_CASE(passOneArgumentByConstAddress) {
     singularity<Horizon>::destroy();
 }
 
+BOOST_AUTO_TEST_CASE(passThreeArgumentsMixingRValuesAndReferences) {
+    Event event(8);
+    Horizon & horizon = singularity<Horizon>::create(1, &event, event);
+    BOOST_CHECK_EQUAL(horizon.mInt, 1);
+    BOOST_CHECK_EQUAL(horizon.mEventPtr->mValue, 8);
+    BOOST_CHECK_EQUAL(horizon.mEventRef.mValue, 8);
+    singularity<Horizon>::destroy();
+}
+
 BOOST_AUTO_TEST_CASE(passFiveArgumentsAvoidingNonConstRValues) {
     Event event(11);
     Horizon & horizon = singularity<Horizon>::create(cref(10), event, cref(&event), event, cref(&event));
@@ -209,4 +334,304 @@ BOOST_AUTO_TEST_CASE(demonstrateGlobalMultiThreadedUsage) {
     singularityType::destroy();
 }
 
+BOOST_AUTO_TEST_CASE(demonstrateLockFreeGetUsage) {
+    typedef singularity<Horizon, lock_free_get> singularityType;
+
+    Horizon & horizon = singularityType::create_global();
+    Horizon & SameHorizon = singularityType::get_global();
+    BOOST_CHECK_EQUAL(&horizon, &SameHorizon);
+
+    singularityType::destroy();
+    BOOST_CHECK_THROW(
+        Horizon & noHorizon = singularityType::get_global(),
+        boost::singularity_not_created
+    );
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateSharedMultiThreadedUsage) {
+    typedef singularity<Horizon, shared_multi_threaded> singularityType;
+
+    Horizon & horizon = singularityType::create_global(14);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    {
+        singularityType::global_reader reader;
+        BOOST_CHECK_EQUAL(reader->mInt, 14);
+        BOOST_CHECK_EQUAL(&*reader, &horizon);
+    }
+    singularityType::destroy();
+
+    BOOST_CHECK_THROW(
+        singularityType::global_reader reader,
+        boost::singularity_not_created
+    );
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateStaticStorageUsage) {
+    typedef singularity<Horizon, single_threaded, static_storage> singularityType;
+
+    Horizon & horizon = singularityType::create(12);
+    BOOST_CHECK_EQUAL(horizon.mInt, 12);
+    singularityType::destroy();
+
+    Horizon & sameStorage = singularityType::create_global(13);
+    BOOST_CHECK_EQUAL(&horizon, &sameStorage);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mInt, 13);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateCompileTimeGlobalAccess) {
+    typedef singularity<Horizon, lock_free_get, heap_storage, global_access> singularityType;
+
+    BOOST_CHECK_THROW(
+        Horizon & noHorizon = singularityType::get_global(),
+        boost::singularity_not_created
+    );
+
+    Horizon & horizon = singularityType::create_global(15);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(tryCreateShouldReturnNullIfAlreadyCreated) {
+    Horizon * horizon = singularity<Horizon>::try_create(16);
+    BOOST_REQUIRE(horizon != 0);
+    BOOST_CHECK_EQUAL(horizon->mInt, 16);
+    BOOST_CHECK(singularity<Horizon>::try_create() == 0);
+    BOOST_CHECK(singularity<Horizon>::try_create_global() == 0);
+    singularity<Horizon>::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(tryGetGlobalShouldReturnNullIfNotAccessible) {
+    BOOST_CHECK(singularity<Horizon>::try_get_global() == 0);
+
+    Horizon & horizon = singularity<Horizon>::create();
+    BOOST_CHECK(singularity<Horizon>::try_get_global() == 0);
+    singularity<Horizon>::destroy();
+
+    Horizon & globalHorizon = singularity<Horizon>::create_global();
+    BOOST_CHECK_EQUAL(singularity<Horizon>::try_get_global(), &globalHorizon);
+    BOOST_CHECK_EQUAL(&singularity<Horizon>::get_global_unchecked(), &globalHorizon);
+    singularity<Horizon>::destroy();
+
+    BOOST_CHECK(singularity<Horizon>::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateAllocatorStorageUsage) {
+    typedef singularity<Horizon, single_threaded, allocator_storage> singularityType;
+
+    Horizon & horizon = singularityType::create(17);
+    BOOST_CHECK_EQUAL(horizon.mInt, 17);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(arenaStorageShouldReturnEachInstanceToItsArena) {
+    typedef singularity<Horizon, rcu_multi_threaded, arena_storage> singularityType;
+
+    CountingArena first;
+    CountingArena second;
+    arena_storage<Horizon>::use(first);
+    singularityType::create_global(19);
+
+    arena_storage<Horizon>::use(second);
+    Horizon & replacement = singularityType::replace(20);
+    BOOST_CHECK_EQUAL(replacement.mInt, 20);
+    BOOST_CHECK_EQUAL(first.mAllocations, 1);
+    BOOST_CHECK_EQUAL(first.mDeallocations, 1);
+    BOOST_CHECK_EQUAL(second.mAllocations, 1);
+    BOOST_CHECK_EQUAL(second.mDeallocations, 0);
+
+    arena_storage<Horizon>::use(first);
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(first.mDeallocations, 1);
+    BOOST_CHECK_EQUAL(second.mDeallocations, 1);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateArenaStorageUsage) {
+    typedef singularity<Horizon, multi_threaded, arena_storage> singularityType;
+
+    CountingArena arena;
+    arena_storage<Horizon>::use(arena);
+
+    Horizon & horizon = singularityType::create(18);
+    BOOST_CHECK_EQUAL(horizon.mInt, 18);
+    BOOST_CHECK_EQUAL(arena.mAllocations, 1);
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 0);
+
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 1);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateSpinlockMultiThreadedUsage) {
+    typedef singularity<Horizon, spinlock_multi_threaded> singularityType;
+
+    Horizon & horizon = singularityType::create_global(21);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    BOOST_CHECK_THROW(singularityType::create(22), boost::singularity_already_created);
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(demonstrateAdaptiveMultiThreadedUsage) {
+    typedef singularity<Horizon, adaptive_multi_threaded> singularityType;
+
+    Horizon & horizon = singularityType::create_global(23);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &horizon);
+    BOOST_CHECK_THROW(singularityType::create(24), boost::singularity_already_created);
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(declareGlobalShouldBuildOnFirstGetGlobal) {
+    typedef singularity<Horizon, shared_multi_threaded> singularityType;
+
+    Event event(25);
+    singularityType::declare_global(boost::ref(event));
+    BOOST_CHECK_THROW(singularityType::create(26), boost::singularity_already_created);
+    BOOST_CHECK_THROW(singularityType::declare_global(26), boost::singularity_already_created);
+
+    Horizon & horizon = singularityType::get_global();
+    BOOST_CHECK_EQUAL(&horizon.mEventRef, &event);
+    BOOST_CHECK_EQUAL(singularityType::try_get_global(), &horizon);
+    singularityType::destroy();
+
+    // A declaration which was never built is discarded by destroy().
+    singularityType::declare_global(27);
+    singularityType::destroy();
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+    BOOST_CHECK_THROW(singularityType::destroy(), boost::singularity_already_destroyed);
+}
+
+BOOST_AUTO_TEST_CASE(declareGlobalShouldSurviveAThrowingConstructor) {
+    typedef singularity<Reluctant, multi_threaded> singularityType;
+
+    Reluctant::sRefusals = 1;
+    singularityType::declare_global(29);
+    BOOST_CHECK_THROW(singularityType::get_global(), std::runtime_error);
+    BOOST_CHECK_THROW(singularityType::declare_global(30), boost::singularity_already_created);
+
+    BOOST_CHECK_EQUAL(singularityType::get_global().mInt, 29);
+    singularityType::destroy();
+    BOOST_CHECK(singularityType::try_get_global() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(createOrGetGlobalShouldConstructOnce) {
+    typedef singularity<Event, multi_threaded> singularityType;
+
+    Event & event = singularityType::create_or_get_global(1);
+    BOOST_CHECK_EQUAL(&singularityType::create_or_get_global(2), &event);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 1);
+    singularityType::destroy();
+
+    singularityType::create(3);
+    BOOST_CHECK_THROW(singularityType::create_or_get_global(4), boost::singularity_no_global_access);
+    singularityType::destroy();
+
+    singularityType::declare_global(5);
+    BOOST_CHECK_EQUAL(singularityType::create_or_get_global(6).mValue, 5);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(replaceShouldPublishANewInstance) {
+    typedef singularity<Horizon, rcu_multi_threaded> singularityType;
+
+    BOOST_CHECK_THROW(singularityType::replace(33), boost::singularity_not_created);
+
+    singularityType::create_global(33);
+    Horizon & replacement = singularityType::replace(34);
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &replacement);
+    {
+        singularityType::global_reader reader;
+        BOOST_CHECK_EQUAL(reader->mInt, 34);
+    }
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::replace(35), boost::singularity_not_created);
+}
+
+BOOST_AUTO_TEST_CASE(leakAtExitShouldStillDestroyExplicitly) {
+    typedef singularity<Leaked, multi_threaded> singularityType;
+
+    singularityType::create();
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(Leaked::sDestroyed, 1);
+
+    // This instance is deliberately never destroyed.
+    singularityType::create_global();
+    BOOST_CHECK_EQUAL(Leaked::sDestroyed, 1);
+}
+
+BOOST_AUTO_TEST_CASE(instrumentationShouldObserveTheLifecycle) {
+    typedef singularity<Event, counted_single_threaded> singularityType;
+
+    singularityType::create_global(3);
+    BOOST_CHECK_EQUAL(Hooks::sConstructed, 1);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 3);
+    BOOST_CHECK(singularityType::try_get_global() != 0);
+    BOOST_CHECK_EQUAL(Hooks::sAccessed, 2);
+    singularityType::replace(4);
+    BOOST_CHECK_EQUAL(Hooks::sConstructed, 2);
+    BOOST_CHECK_EQUAL(Hooks::sDestroyed, 1);
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(Hooks::sDestroyed, 2);
+}
+
+BOOST_AUTO_TEST_CASE(recreateShouldReuseTheStorage) {
+    typedef singularity<Event, multi_threaded, arena_storage> singularityType;
+
+    CountingArena arena;
+    arena_storage<Event>::use(arena);
+
+    BOOST_CHECK_THROW(singularityType::recreate(1), boost::singularity_not_created);
+    Event & event = singularityType::create_global(1);
+    for (int i = 2; i <= 100; ++i) {
+        BOOST_CHECK_EQUAL(&singularityType::recreate(i), &event);
+    }
+    BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 100);
+    BOOST_CHECK_EQUAL(arena.mAllocations, 1);
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 0);
+
+    singularityType::destroy();
+    BOOST_CHECK_EQUAL(arena.mDeallocations, 1);
+}
+
+BOOST_AUTO_TEST_CASE(recreateShouldOnlyAcceptPoliciesWhoseReadersExcludeWriters) {
+    using ::boost::detail::singularity_readers_exclude_writers;
+
+    BOOST_CHECK(singularity_readers_exclude_writers< single_threaded<Event> >::value);
+    BOOST_CHECK(singularity_readers_exclude_writers< multi_threaded<Event> >::value);
+    BOOST_CHECK(singularity_readers_exclude_writers< shared_multi_threaded<Event> >::value);
+    BOOST_CHECK(!singularity_readers_exclude_writers< lock_free_get<Event> >::value);
+    BOOST_CHECK(!singularity_readers_exclude_writers< rcu_multi_threaded<Event> >::value);
+    BOOST_CHECK(!singularity_readers_exclude_writers< compact_multi_threaded<Event> >::value);
+}
+
+BOOST_AUTO_TEST_CASE(passArgumentsByMove) {
+    typedef singularity<Channel> singularityType;
+
+    Buffer buffer(64);
+    int const id = 9;
+    Channel & channel = singularityType::create(::boost::move(buffer), id);
+    BOOST_CHECK_EQUAL(channel.mBuffer.mSize, 64);
+    BOOST_CHECK_EQUAL(channel.mId, 9);
+    BOOST_CHECK_EQUAL(buffer.mSize, 0);
+    BOOST_CHECK_EQUAL(Buffer::sMoves, 1);
+    singularityType::destroy();
+}
+
+BOOST_AUTO_TEST_CASE(compactStateShouldFitInOneWord) {
+    typedef singularity<Flag, compact_multi_threaded, static_storage> singularityType;
+
+    BOOST_CHECK_EQUAL(sizeof(boost::detail::singularity_pointer<Flag>), sizeof(void *));
+
+    Flag & flag = singularityType::create_global('a');
+    BOOST_CHECK_EQUAL(&singularityType::get_global(), &flag);
+    BOOST_CHECK_EQUAL(singularityType::get_global().mValue, 'a');
+    BOOST_CHECK_EQUAL(&singularityType::create_or_get_global('b'), &flag);
+    singularityType::destroy();
+    BOOST_CHECK_THROW(singularityType::get_global(), boost::singularity_not_created);
+
+    singularityType::create('c');
+    BOOST_CHECK_THROW(singularityType::get_global(), boost::singularity_no_global_access);
+    singularityType::destroy();
+}
+
 } // namespace anonymous